@@ -19,9 +19,10 @@
 /* initialized from the hex digits of pi 
  * these arrays can be verified from the original source
  * https://www.schneier.com/code/constants.txt 
+ * every key schedule is expanded from a fresh copy of them
  */
 
-uint32_t sbox[4][256] = {
+const uint32_t sbox_init[4][256] = {
 	{
 0xd1310ba6, 0x98dfb5ac, 0x2ffd72db, 0xd01adfb7, 0xb8e1afed, 0x6a267e96,
 0xba7c9045, 0xf12c7f99, 0x24a19947, 0xb3916cf7, 0x0801f2e2, 0x858efc16,
@@ -206,7 +207,7 @@ uint32_t sbox[4][256] = {
 }
 };
 
-uint32_t pbox[18] = {
+const uint32_t pbox_init[18] = {
 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344, 0xa4093822, 0x299f31d0,
 0x082efa98, 0xec4e6c89, 0x452821e6, 0x38d01377, 0xbe5466cf, 0x34e90c6c,
 0xc0ac29b7, 0xc97c50dd, 0x3f84d5b5, 0xb5470917, 0x9216d5d9, 0x8979fb1b
@@ -224,16 +225,16 @@ uint32_t pbox[18] = {
 // typedef unsigned long long int uint64_t;
 
 uint32_t 
-feistel_function(uint32_t arg);
+feistel_function(uint32_t arg, uint32_t sbox[4][256]);
 
 void 
-_encrypt(uint32_t *left, uint32_t *right);
+_encrypt(uint32_t *left, uint32_t *right, uint32_t pbox[18], uint32_t sbox[4][256]);
 
 void
-_decrypt(uint32_t *left, uint32_t *right);
+_decrypt(uint32_t *left, uint32_t *right, uint32_t pbox[18], uint32_t sbox[4][256]);
 
 void
-blowfish_init(uint8_t key[], int padsize);
+blowfish_init(uint8_t key[], int padsize, uint32_t pbox[18], uint32_t sbox[4][256]);
 
 // uint8_t *
 // blowfish_encrypt(uint8_t data[], int padsize);
@@ -243,10 +244,35 @@ blowfish_init(uint8_t key[], int padsize);
 
 
 #define MAX_DATA_SIZE (8*1024*1024) // 10MB
+//LONGEST BLOWFISH KEY IN BYTES
+#define MAX_KEY_SIZE 56
+//KEY SCHEDULES RESIDENT IN EVERY PE, A REQUEST PICKS ONE BY ITS KEY ID. MUST MATCH BLOWFISH_KEYS IN host.cpp
+#ifndef BLOWFISH_KEYS
+#define BLOWFISH_KEYS 4
+#endif
+//CODE THAT LOADS A KEY INTO THE TABLE, NEXT TO EXIT (1) AND COMPUTE (2)
+#define LOAD_KEY_CODE 3
+//ONE 64-BIT BLOCK PER LANE, SO A 512-BIT BEAT IS ENCRYPTED PER CYCLE
+#define BLOWFISH_LANES (BUS_WIDTH_BYTES / 8)
+//A DUAL PORT S-BOX COPY SERVES TWO ROUNDS, SO EVERY LANE HOLDS 8 COPIES FOR ITS 16 ROUNDS
+#define BLOWFISH_ROUNDS_PER_COPY 2
+#define BLOWFISH_SBOX_COPIES (16 / BLOWFISH_ROUNDS_PER_COPY)
+//ARGUMENT OF A COMPUTE REQUEST: KEY ID IN BITS 0-7, MODE IN BITS 8-9, RESTART IN BIT 10, DECRYPT IN BIT 11, STREAM IN BITS 16-23.
+//THE OPERAND IS THE IV (CBC) OR THE FIRST COUNTER (CTR) OF A STREAM, TAKEN ONLY WHEN RESTART IS SET. OTHERWISE THE
+//STREAM GOES ON FROM WHERE ITS LAST REQUEST ON THIS PE LEFT IT, SO ITS REQUESTS SHOULD SHARE AN HMLib AFFINITY
+#define BLOWFISH_MODE_ECB 0
+#define BLOWFISH_MODE_CBC 1
+#define BLOWFISH_MODE_CTR 2
+#define BLOWFISH_RESTART (1 << 10)
+#define BLOWFISH_DECRYPT (1 << 11)
+//CHAINING STATE KEPT PER PE, STREAM IDS WRAP AROUND
+#ifndef BLOWFISH_STREAMS
+#define BLOWFISH_STREAMS 16
+#endif
 
 
 uint32_t 
-feistel_function(uint32_t arg)
+feistel_function(uint32_t arg, uint32_t sbox[4][256])
 {
 	#pragma HLS inline
 	uint32_t var = sbox[0][arg >> 24] + sbox[1][(uint8_t)(arg >> 16)];
@@ -254,15 +280,15 @@ feistel_function(uint32_t arg)
 }
 
 void 
-_encrypt(uint32_t *left, uint32_t *right)
+_encrypt(uint32_t *left, uint32_t *right, uint32_t pbox[18], uint32_t sbox[4][256])
 {
 	#pragma HLS inline
 	uint32_t i, t;
 	for (i = 0; i < 16; i++) {
 		#pragma HLS pipeline II=1
 		*left  ^= pbox[i];
-		// *right ^= feistel_function(*left);
-		
+		*right ^= feistel_function(*left, sbox);
+
 		SWAP(*left, *right, t);
 	}
 
@@ -272,14 +298,14 @@ _encrypt(uint32_t *left, uint32_t *right)
 }
 
 void
-_decrypt(uint32_t *left, uint32_t *right)
+_decrypt(uint32_t *left, uint32_t *right, uint32_t pbox[18], uint32_t sbox[4][256])
 {
 	#pragma HLS inline
 	uint32_t i, t;
 	for (i = 17; i > 1; i--) {
 		#pragma HLS pipeline II=1
 		*left  ^= pbox[i];
-		*right ^= feistel_function(*left);
+		*right ^= feistel_function(*left, sbox);
 
 		SWAP(*left, *right, t);
 	}
@@ -290,25 +316,38 @@ _decrypt(uint32_t *left, uint32_t *right)
 }
 
 void
-blowfish_init(uint8_t key[], int size)
+blowfish_init(uint8_t key[], int size, uint32_t pbox[18], uint32_t sbox[4][256])
 {
 	#pragma HLS inline
 	int keysize = size, i, j;
 	uint32_t left = 0x00000000, right = 0x00000000;
 
+	/* start over from the pi digits, so the schedule only depends on this key */
+	for (i = 0; i < 18; i++) {
+		#pragma HLS pipeline II=1
+		pbox[i] = pbox_init[i];
+	}
+
+	for (i = 0; i <= 3; i++) {
+		for (j = 0; j <= 255; j++) {
+			#pragma HLS pipeline II=1
+			sbox[i][j] = sbox_init[i][j];
+		}
+	}
+
 	/* subkey generation */
 	for (i = 0; i < 18; i++) {
 		#pragma HLS pipeline II=1
-		pbox[i] ^= ((uint32_t)key[(i + 0) % keysize] << 24) | 
-		           ((uint32_t)key[(i + 1) % keysize] << 16) | 
-		           ((uint32_t)key[(i + 2) % keysize] <<  8) | 
-		           ((uint32_t)key[(i + 3) % keysize]);
+		pbox[i] ^= ((uint32_t)key[(4 * i + 0) % keysize] << 24) | 
+		           ((uint32_t)key[(4 * i + 1) % keysize] << 16) | 
+		           ((uint32_t)key[(4 * i + 2) % keysize] <<  8) | 
+		           ((uint32_t)key[(4 * i + 3) % keysize]);
 	}
 
 	/* encrypt the zeroes, modifying the p-array and s-boxes accordingly */
 	for (i = 0; i <= 17; i += 2) {
 		#pragma HLS pipeline II=1
-		_encrypt(&left, &right);
+		_encrypt(&left, &right, pbox, sbox);
 		pbox[i]     = left;
 		pbox[i + 1] = right;
 	}
@@ -316,7 +355,7 @@ blowfish_init(uint8_t key[], int size)
 	for (i = 0; i <= 3; i++) {
 		for (j = 0; j <= 254; j += 2) {
 			#pragma HLS pipeline II=1
-			_encrypt(&left, &right);
+			_encrypt(&left, &right, pbox, sbox);
 			sbox[i][j]     = left;
 			sbox[i][j + 1] = right;
 		}
@@ -326,7 +365,7 @@ blowfish_init(uint8_t key[], int size)
 
 
 void
-blowfish_encrypt(uint8_t data[], int padsize, uint8_t encrypted[])
+blowfish_encrypt(uint8_t data[], int padsize, uint8_t encrypted[], uint32_t pbox[18], uint32_t sbox[4][256])
 {
 
 	#pragma HLS inline
@@ -371,7 +410,7 @@ blowfish_encrypt(uint8_t data[], int padsize, uint8_t encrypted[])
 		// 	}
 		// }
 
-		_encrypt(&left, &right);
+		_encrypt(&left, &right, pbox, sbox);
 
 		/* merge encrypted halves into a single 8 byte chunk again */
 		chunk = 0x0000000000000000;
@@ -391,7 +430,7 @@ blowfish_encrypt(uint8_t data[], int padsize, uint8_t encrypted[])
 
 
 void
-blowfish_decrypt(uint8_t crypt_data[], int padsize, uint8_t decrypted[])
+blowfish_decrypt(uint8_t crypt_data[], int padsize, uint8_t decrypted[], uint32_t pbox[18], uint32_t sbox[4][256])
 {
 	// uint8_t *decrypted = malloc(sizeof *decrypted * padsize);
 	// uint8_t decrypted[MAX_DATA_SIZE];
@@ -421,7 +460,7 @@ blowfish_decrypt(uint8_t crypt_data[], int padsize, uint8_t decrypted[])
 		left   = (uint32_t)(chunk >> 32);
 		right  = (uint32_t)(chunk);
 
-		_decrypt(&left, &right);
+		_decrypt(&left, &right, pbox, sbox);
 
 		chunk = 0x0000000000000000;
 		chunk |= left; chunk <<= 32;
@@ -442,131 +481,230 @@ blowfish_decrypt(uint8_t crypt_data[], int padsize, uint8_t decrypted[])
 }
 
 
-void krnl_blowfish(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, unsigned int sizes[4], unsigned int& iterations, unsigned int batchCount){
-	
-	/********************************START OF BLOWFISH INITIALIZATION************************************/
-
-	int i, Osize, Psize, Pbyte;
-	int KOsize, KPsize, KPbyte;
-	uint8_t *decrypted, data[BUS_WIDTH_BYTES];
+//PADS THE FIRST keySize BYTES OF key TO A MULTIPLE OF 8 AND EXPANDS THEM INTO ENTRY keyId OF THE KEY TABLE
+void expandKey(uint8_t key[MAX_KEY_SIZE], int keySize, unsigned int keyId, uint32_t pboxTable[BLOWFISH_KEYS][18], uint32_t sboxTable[BLOWFISH_KEYS][4][256]){
+	#pragma HLS inline off
 
-	// default key and hardcoded
-	char key[] = "the key is you";
+	int KPsize, KPbyte;
 
-	Osize = BUS_WIDTH_BYTES;         KOsize = 14; // hardcoded key size
-	Psize = ceil(Osize / 8.0) * 8;   KPsize = ceil(KOsize / 8.0) * 8;
-	Pbyte = Psize - Osize;           KPbyte = KPsize - KOsize;
+	KPsize = ceil(keySize / 8.0) * 8;
+	KPbyte = KPsize - keySize;
 
 	/* padding bytes added to the key */
-    memset(key + KOsize, KPbyte, sizeof *key * KPbyte);
+	memset(key + keySize, KPbyte, sizeof *key * KPbyte);
 
-	// Initialization for each DataFile
-    blowfish_init((uint8_t *)key, KPsize);
-
-	/********************************END OF BLOWFISH INITIALIZATION************************************/
-	
-	// uint32_t crc = 0;
-	unsigned int countNum = 0;
-	unsigned int size = 0;	
-	
-	unsigned int outputSize = sizes[countNum]; 
+	blowfish_init(key, KPsize, pboxTable[keyId], sboxTable[keyId]);
+}
 
+//EVERY ENTRY STARTS OUT WITH THE BUILT-IN KEY, SO A HOST THAT NEVER LOADS A KEY STILL GETS IT FOR ANY ID
+void loadDefaultKeys(uint32_t pboxTable[BLOWFISH_KEYS][18], uint32_t sboxTable[BLOWFISH_KEYS][4][256]){
+	#pragma HLS inline off
 
-	/**** tmp variables for debug purpose --> delete in future */
-	unsigned int tmp = 0;
-	/*** end of tmp vairables*/
+	// default key and hardcoded
+	const char defaultKey[] = "the key is you";
+	int KOsize = 14; // hardcoded key size
 
+	for(unsigned int k = 0; k < BLOWFISH_KEYS; k++){
+		uint8_t key[MAX_KEY_SIZE];
+		memcpy(key, defaultKey, KOsize);
+		expandKey(key, KOsize, k, pboxTable, sboxTable);
+	}
+}
 
-	//TODO: MODIFY YOUR CORE KERNEL TO HANDLE 512 BIT INPUT
-	COMPUTE: for(int i = 0; i < iterations; i++){
-		// #pragma HLS loop_tripcount min=8 max=8
-		// #pragma HLS pipeline II=32
+//LOAD KEY: THE KEY IS THE FIRST sizes[0] BYTES (1 TO 56) OF THE iterations LINES THAT FOLLOW, ITS SCHEDULE REPLACES ENTRY keyId.
+//A KEY OF ANY OTHER SIZE LEAVES THE ENTRY AS IT WAS. THE REQUEST CLOSES WITH AN EMPTY OUTPUT
+void krnl_load_key(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, unsigned int sizes[4], unsigned int& iterations, unsigned int keyId,
+	uint32_t pboxTable[BLOWFISH_KEYS][18], uint32_t sboxTable[BLOWFISH_KEYS][4][256]){
 
-		uint8_t plainText[BUS_WIDTH_BYTES], cipherText[BUS_WIDTH_BYTES], decryptedText[BUS_WIDTH_BYTES];
+	uint8_t key[MAX_KEY_SIZE];
 
+	for(int i = 0; i < iterations; i++){
 		ap_uint<512> get1 = hostMemStrmToUserBuffer.read();
-		
-		for (int j = 0; j < 64; j++) {
-			// reformat the input data to 64 bytes for blowfish
-    		plainText[j] = get1.range(8*j+7,8*j);
-			// if(stevez_debug){
-			// 	if(plainText[j] == 'A')
-			// 		tmp++;
-			// }
+		if(i == 0){
+			for(int j = 0; j < MAX_KEY_SIZE; j++){
+				#pragma HLS unroll
+				key[j] = get1.range(8*j+7,8*j);
+			}
 		}
+	}
 
-		memset(plainText + Osize, Pbyte, sizeof *plainText * Pbyte);
-	
-		blowfish_encrypt(plainText, Psize, cipherText);
-
-		// blowfish_decrypt(cipherText, Psize, decryptedText);
-
-		// Convert cipherText to a 512-bit packet
-        // ap_uint<512> cipherPkt;
-        // for (int j = 0; j < 64; j++) {
-        //     cipherPkt.range(8*j+7, 8*j) = cipherText[j];
-        // }
+	if(sizes[0] >= 1 && sizes[0] <= MAX_KEY_SIZE){
+		expandKey(key, sizes[0], keyId % BLOWFISH_KEYS, pboxTable, sboxTable);
+	}
 
-		// if(stevez_debug){
-		// 	if(tmp == 64){
-		// 		tmp = 0;
-		// 		cipherPkt = 77;
-		// 	}
-		// 	else{
-		// 		cipherPkt = 88;
-		// 	}
-		// }
-		
-		// Initialize cipherText to 0
-		// memset(cipherText, 13, sizeof(cipherText));
+	ap_axiu<514,0,0,0> sendPkt;
+	sendPkt.data = 0;
+	sendPkt.data.range(512,512) = 1;
+	hostMemStrmFromUser.write(sendPkt);
+}
 
-		// ap_uint<512> cipherPkt;
-        // for (int j = 0; j < 64; j++) {
-        //     cipherPkt.range(8*j+7, 8*j) = cipherText[j];
-        // }
+//COPIES THE P-ARRAY OF TABLE ENTRY key INTO THE ENGINE. DECRYPTION IS THE SAME ROUNDS WITH THE P-ARRAY IN REVERSE ORDER
+void loadPArray(unsigned int key, bool reverse, uint32_t pboxTable[BLOWFISH_KEYS][18], uint32_t pbox[18]){
+	#pragma HLS inline off
 
-		size += 64;
-		if(size >= sizes[countNum]){
-			countNum++;
-			size = 0;
+	for(int i = 0; i < 18; i++){
+		#pragma HLS pipeline II=1
+		pbox[i] = pboxTable[key][reverse ? 17 - i : i];
+	}
+}
 
-			//TODO: SEND OUTPUT DATA ONCE 512 BITS ARE FILLED OR LAST OUTPUT
-			ENFORCE_ORDER:{
+//COPIES THE S-BOXES OF TABLE ENTRY key INTO EVERY S-BOX COPY OF EVERY LANE OF THE ENGINE, 256 CYCLES
+void loadEngine(unsigned int key, uint32_t sboxTable[BLOWFISH_KEYS][4][256], uint32_t sboxCopies[BLOWFISH_LANES][BLOWFISH_SBOX_COPIES][4][256]){
+	#pragma HLS inline off
 
-				ap_axiu<514,0,0,0> sendPkt;
-				for(int k = 0; k < BUS_WIDTH_BYTES; k++){
+	for(int j = 0; j < 256; j++){
+		#pragma HLS pipeline II=1
+		for(int s = 0; s < 4; s++){
+			#pragma HLS unroll
+			uint32_t value = sboxTable[key][s][j];
+			for(int l = 0; l < BLOWFISH_LANES; l++){
+				#pragma HLS unroll
+				for(int c = 0; c < BLOWFISH_SBOX_COPIES; c++){
 					#pragma HLS unroll
-					sendPkt.data.range(8*k+7, 8*k) = cipherText[k];
+					sboxCopies[l][c][s][j] = value;
 				}
+			}
+		}
+	}
+}
 
-				hostMemStrmFromUser.write(sendPkt);
-				
-				ap_wait();
+//_encrypt WITH ITS 16 ROUNDS UNROLLED INTO A PIPELINE, ROUND r READS S-BOX COPY r / BLOWFISH_ROUNDS_PER_COPY
+void encryptBlock(uint32_t& left, uint32_t& right, uint32_t pbox[18], uint32_t sbox[BLOWFISH_SBOX_COPIES][4][256]){
+	#pragma HLS inline
+	uint32_t t;
+	ROUNDS: for(int i = 0; i < 16; i++){
+		#pragma HLS unroll
+		left  ^= pbox[i];
+		right ^= feistel_function(left, sbox[i / BLOWFISH_ROUNDS_PER_COPY]);
+
+		SWAP(left, right, t);
+	}
+
+	SWAP(left, right, t);
+	right ^= pbox[16];
+	left  ^= pbox[17];
+}
+
+//BLOCKS OF AN INPUT OF inputSize BYTES THAT FALL IN THE LINE AT BYTE offset, THE REST OF THE LAST LINE IS PADDING
+unsigned int validBlocks(unsigned int inputSize, unsigned int offset){
+	unsigned int remaining = (inputSize > offset) ? inputSize - offset : 0;
+	return (remaining >= BUS_WIDTH_BYTES) ? BLOWFISH_LANES : (remaining + 7) / 8;
+}
+
+//RUNS THE iterations LINES OF A REQUEST THROUGH THE ENGINE, ONE LINE PER CYCLE. ECB ENCRYPTS (OR WITH A REVERSED P-ARRAY
+//DECRYPTS) EVERY BLOCK. CTR ENCRYPTS THE COUNTERS chain, chain+1, ... AND XORS THEM INTO THE BLOCKS IN BOTH DIRECTIONS,
+//LEAVING chain AT THE NEXT COUNTER. CBC DECRYPTION XORS EVERY DECRYPTED BLOCK WITH THE CIPHERTEXT BEFORE IT, WHICH IS
+//ALREADY IN THE LINE (OR chain FOR THE FIRST ONE), SO IT NEEDS NO SERIAL LOOP. chain IS LEFT AT THE LAST CIPHERTEXT BLOCK.
+//ONLY THE ceil(sizes[countNum]/8) BLOCKS OF AN INPUT MOVE chain, SO A STREAM SPLIT AT ANY BLOCK BOUNDARY CHAINS THE SAME
+//EVERY TRIP WRITES ONE PACKET: A LINE OF OUTPUT, OR THE SIZE PACKET THAT CLOSES A BATCHED INPUT
+void krnl_blowfish(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, unsigned int sizes[4], unsigned int& iterations, unsigned int batchCount,
+	unsigned int mode, uint64_t& chain, uint32_t pbox[18], uint32_t sboxCopies[BLOWFISH_LANES][BLOWFISH_SBOX_COPIES][4][256]){
+
+	unsigned int countNum = 0;
+	unsigned int size = 0;
+	bool closeInput = false;
+	bool counterMode = (mode == BLOWFISH_MODE_CTR);
+	bool chainMode = (mode == BLOWFISH_MODE_CBC);
+
+	//EACH BATCHED INPUT IS ENCRYPTED INTO ITS OWN OUTPUT, CLOSED BY A SIZE PACKET WITH BIT-512 SET
+	COMPUTE: for(unsigned int i = 0; i < iterations + batchCount; i++){
+		#pragma HLS pipeline II=1
+		ap_axiu<514,0,0,0> sendPkt;
 
-				//TODO: IF ITS THE LAST OUTPUT, SEND OUTPUT SIZE AND SET BIT-512 TO 1
-				sendPkt.data = outputSize;
-				sendPkt.data.range(512,512) = 1;
-				hostMemStrmFromUser.write(sendPkt);
+		if(closeInput){
+			sendPkt.data = sizes[countNum];
+			sendPkt.data.range(512,512) = 1;
+			countNum++;
+			closeInput = false;
+		}else{
+			ap_uint<512> get1 = hostMemStrmToUserBuffer.read();
+			unsigned int valid = validBlocks(sizes[countNum], size);
+			uint64_t last = chain;
+
+			//A LINE IS BLOWFISH_LANES BLOCKS OF 8 LITTLE ENDIAN BYTES, THE HIGH WORD IS THE LEFT HALF
+			LANES: for(int l = 0; l < BLOWFISH_LANES; l++){
+				#pragma HLS unroll
+				uint64_t block = get1.range(64*l+63, 64*l);
+				uint64_t counter = chain + l;
+				uint64_t text = counterMode ? counter : block;
+				uint32_t left = text >> 32;
+				uint32_t right = text;
+
+				encryptBlock(left, right, pbox, sboxCopies[l]);
+
+				uint64_t cipher = ((uint64_t)left << 32) | right;
+				uint64_t previous = (l == 0) ? chain : (uint64_t)get1.range(64*l-1, 64*l-64);
+				sendPkt.data.range(64*l+63, 64*l) = counterMode ? (cipher ^ block) : (chainMode ? (cipher ^ previous) : cipher);
+				if((unsigned int)l < valid){
+					last = block;
+				}
+			}
+			if(counterMode){
+				chain += valid;
+			}else if(chainMode){
+				chain = last;
 			}
 
-			// crc = 0;
+			size += BUS_WIDTH_BYTES;
+			if(size >= sizes[countNum]){
+				size = 0;
+				closeInput = true;
+			}
 		}
-		else{
-			// send the encrypted data to the host for each ciphertext packet (64 bytes)
-			ap_axiu<514,0,0,0> sendPkt;
-			for(int k = 0; k < BUS_WIDTH_BYTES; k++){
-				#pragma HLS unroll
-				sendPkt.data.range(8*k+7, 8*k) = cipherText[k];
+
+		hostMemStrmFromUser.write(sendPkt);
+	}
+}
+
+//CBC ENCRYPTION: EVERY BLOCK IS XORED WITH THE CIPHERTEXT BEFORE IT (chain) AND ENCRYPTED, SO THE BLOCKS OF A STREAM GO THROUGH THE
+//ROUNDS ONE AFTER ANOTHER AND ONLY LANE 0 OF THE ENGINE IS USED. THE LOOP STOPS AT THE LAST BLOCK OF THE INPUT, WHERE chain IS LEFT.
+//INDEPENDENT STREAMS ON OTHER PEs RUN IN PARALLEL
+void krnl_blowfish_cbc(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, unsigned int sizes[4], unsigned int& iterations, unsigned int batchCount,
+	uint64_t& chain, uint32_t pbox[18], uint32_t sboxCopies[BLOWFISH_LANES][BLOWFISH_SBOX_COPIES][4][256]){
+
+	unsigned int countNum = 0;
+	unsigned int size = 0;
+	bool closeInput = false;
+
+	CHAIN: for(unsigned int i = 0; i < iterations + batchCount; i++){
+		ap_axiu<514,0,0,0> sendPkt;
+
+		if(closeInput){
+			sendPkt.data = sizes[countNum];
+			sendPkt.data.range(512,512) = 1;
+			countNum++;
+			closeInput = false;
+		}else{
+			ap_uint<512> get1 = hostMemStrmToUserBuffer.read();
+			unsigned int valid = validBlocks(sizes[countNum], size);
+
+			sendPkt.data = 0;
+			BLOCKS: for(unsigned int l = 0; l < valid; l++){
+				#pragma HLS loop_tripcount max=8 min=1
+				#pragma HLS pipeline
+				uint64_t text = (uint64_t)get1.range(64*l+63, 64*l) ^ chain;
+				uint32_t left = text >> 32;
+				uint32_t right = text;
+
+				encryptBlock(left, right, pbox, sboxCopies[0]);
+
+				chain = ((uint64_t)left << 32) | right;
+				sendPkt.data.range(64*l+63, 64*l) = chain;
 			}
 
-			hostMemStrmFromUser.write(sendPkt);
+			size += BUS_WIDTH_BYTES;
+			if(size >= sizes[countNum]){
+				size = 0;
+				closeInput = true;
+			}
 		}
-		
+
+		hostMemStrmFromUser.write(sendPkt);
 	}
 }
 
 void functionControl(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, 
-	bool state[2], unsigned int sizes[4], unsigned int& iterations, unsigned int batchCount){
+	bool state[3], unsigned int sizes[4], unsigned int& iterations, unsigned int& batchCount, unsigned int& argument, uint64_t& operand){
 	#pragma HLS inline off
 
 	ap_uint<512> getPkt = hostMemStrmToUserBuffer.read();
@@ -576,6 +714,7 @@ void functionControl(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::st
 
 	//SET PE TO EXIT code = 1
 	//SET PE TO COMPUTE code = 2
+	//LOAD A KEY code = 3
 
 	//TODO: BUILD YOUR OWN FSM OR KEEP THE CURRENT VERSION
 	if(code.range(31,0) == 1){
@@ -589,21 +728,36 @@ void functionControl(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::st
 		hostMemStrmFromUser.write(sendPkt);
 	}else if(code.range(31,0) == 2){
 		//TODO: CODE 2 MATCHES WITH HELPER.CPP
+		//GET THE NUMBER OF BATCHED INPUTS FROM BIT RANGE 32-63
 		//GET THE NUMBER OF ITERATION IN TERMS OF 64 BYTES FROM BIT RANGE 64-95
-		//batchCount = code.range(63,32);
+		batchCount = code.range(63,32);
 		iterations = code.range(95,64);
 		
-		//TODO: GET THE ORIGINAL INPUT SIZE FROM BIT 96-127
+		//TODO: GET THE ORIGINAL INPUT SIZES FROM BIT 96-223, UNUSED ENTRIES ARE 0
+		//EVERY BATCHED INPUT STARTS ON A NEW 64 BYTE LINE
 		sizes[0] = code.range(127,96);
-		/*sizes[1] = code.range(159,128);
+		sizes[1] = code.range(159,128);
 		sizes[2] = code.range(191,160);
-		sizes[3] = code.range(223,192);*/
+		sizes[3] = code.range(223,192);
+
+		//THE HOST'S ARGUMENT IN BIT 224-255 (KEY ID, MODE, STREAM) AND ITS OPERAND IN BIT 256-319
+		argument = code.range(255,224);
+		operand = code.range(319,256);
 
 		//TODO: ACKNOWLEDGE THE CODE
 		state[1] = true;
 		sendPkt.data = 2;
 		hostMemStrmFromUser.write(sendPkt);
-	}	
+	}else if(code.range(31,0) == LOAD_KEY_CODE){
+		//THE LINES OF THE KEY, ITS SIZE IN BIT 96-127 AND THE TABLE ENTRY IT GOES TO IN BIT 224-255
+		iterations = code.range(95,64);
+		sizes[0] = code.range(127,96);
+		argument = code.range(255,224);
+
+		state[2] = true;
+		sendPkt.data = LOAD_KEY_CODE;
+		hostMemStrmFromUser.write(sendPkt);
+	}
 }
 
 template <int number>
@@ -613,10 +767,41 @@ void blowfishPE(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<
 	unsigned sizes[4];
 	unsigned int iterations;
 	unsigned int batchCount;
-	bool state[2];
+	unsigned int argument = 0;
+	uint64_t operand = 0;
+	bool state[3];
 	#pragma HLS array_partition variable=state dim=0 complete
 
-	for(int i = 0; i < 2; i++){
+	//KEY TABLE OF THIS PE: ONE EXPANDED SCHEDULE PER KEY ID, KEPT IN BRAM. A KEY IS ONLY EXPANDED (521 BLOCK ENCRYPTIONS)
+	//WHEN IT IS LOADED, THE ENGINE IS FILLED FROM THE TABLE. ONE BANK PER S-BOX SO AN ENTRY IS COPIED OUT IN 256 CYCLES
+	uint32_t pboxTable[BLOWFISH_KEYS][18];
+	uint32_t sboxTable[BLOWFISH_KEYS][4][256];
+	#pragma HLS array_partition variable=pboxTable dim=2 complete
+	#pragma HLS array_partition variable=sboxTable dim=2 complete
+
+	loadDefaultKeys(pboxTable, sboxTable);
+
+	//ENGINE: THE SCHEDULE IN USE, WITH ITS S-BOXES REPLICATED SO ALL ROUNDS OF ALL LANES READ IN THE SAME CYCLE.
+	//BLOWFISH_LANES x BLOWFISH_SBOX_COPIES x 4 KB OF BRAM. REFILLED FROM THE TABLE ONLY WHEN THE KEY ID OR DIRECTION CHANGES
+	uint32_t pbox[18];
+	uint32_t sboxCopies[BLOWFISH_LANES][BLOWFISH_SBOX_COPIES][4][256];
+	#pragma HLS array_partition variable=pbox complete
+	#pragma HLS array_partition variable=sboxCopies dim=1 complete
+	#pragma HLS array_partition variable=sboxCopies dim=2 complete
+	#pragma HLS array_partition variable=sboxCopies dim=3 complete
+	#pragma HLS bind_storage variable=sboxCopies type=ram_2p impl=bram
+	//BLOWFISH_KEYS MEANS THE ENGINE HOLDS NO SCHEDULE
+	unsigned int engineKey = BLOWFISH_KEYS;
+	bool engineReverse = false;
+
+	//NEXT IV (CBC) OR COUNTER (CTR) OF EVERY STREAM
+	uint64_t chainTable[BLOWFISH_STREAMS];
+	for(int i = 0; i < BLOWFISH_STREAMS; i++){
+		#pragma HLS pipeline II=1
+		chainTable[i] = 0;
+	}
+
+	for(int i = 0; i < 3; i++){
 		#pragma HLS unroll
 		state[i] = false;
 	}
@@ -625,11 +810,43 @@ void blowfishPE(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<
 	while(!state[0]){
 		#pragma HLS loop_tripcount max=10 min=10
 
-		functionControl(hostMemStrmToUserBuffer, hostMemStrmFromUser, state, sizes, iterations, batchCount);
+		functionControl(hostMemStrmToUserBuffer, hostMemStrmFromUser, state, sizes, iterations, batchCount, argument, operand);
 		if(state[1]){
-			krnl_blowfish(hostMemStrmToUserBuffer, hostMemStrmFromUser, sizes, iterations, batchCount);
+			//IDS PAST THE END OF THE TABLES WRAP AROUND
+			unsigned int key = (argument & 0xFF) % BLOWFISH_KEYS;
+			unsigned int mode = (argument >> 8) & 0x3;
+			unsigned int stream = ((argument >> 16) & 0xFF) % BLOWFISH_STREAMS;
+			uint64_t chain = (argument & BLOWFISH_RESTART) ? operand : chainTable[stream];
+			bool decrypt = (argument & BLOWFISH_DECRYPT) != 0;
+			//CTR ONLY EVER ENCRYPTS THE COUNTERS
+			bool reverse = decrypt && mode != BLOWFISH_MODE_CTR;
+
+			//A NEW KEY REFILLS THE WHOLE ENGINE, A NEW DIRECTION ONLY THE 18 P-ARRAY ENTRIES
+			if(key != engineKey){
+				loadEngine(key, sboxTable, sboxCopies);
+			}
+			if(key != engineKey || reverse != engineReverse){
+				loadPArray(key, reverse, pboxTable, pbox);
+			}
+			engineKey = key;
+			engineReverse = reverse;
+
+			if(mode == BLOWFISH_MODE_CBC && !decrypt){
+				krnl_blowfish_cbc(hostMemStrmToUserBuffer, hostMemStrmFromUser, sizes, iterations, batchCount, chain, pbox, sboxCopies);
+			}else{
+				krnl_blowfish(hostMemStrmToUserBuffer, hostMemStrmFromUser, sizes, iterations, batchCount, mode, chain, pbox, sboxCopies);
+			}
+			chainTable[stream] = chain;
 			state[1] = false;
 		}
+		if(state[2]){
+			krnl_load_key(hostMemStrmToUserBuffer, hostMemStrmFromUser, sizes, iterations, argument, pboxTable, sboxTable);
+			//A NEW KEY IN THE ENTRY THE ENGINE WAS FILLED FROM MAKES IT STALE
+			if(argument % BLOWFISH_KEYS == engineKey){
+				engineKey = BLOWFISH_KEYS;
+			}
+			state[2] = false;
+		}
 	}
 	stopSignal.write(true);
 }
@@ -651,6 +868,13 @@ void bufferData(hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser, hls::stream
 	}
 }
 
+#ifdef HMLIB_SOFTWARE
+//ENTRY FOR THE HMLib SOFTWARE BACKEND (hmlib_sw.h), WHICH FEEDS THE PE DIRECTLY IN PLACE OF bufferData
+void blowfish_SW(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal){
+	blowfishPE<0>(hostMemStrmToUserBuffer, hostMemStrmFromUser, stopSignal);
+}
+#endif
+
 extern "C" {
 
 void blowfish_HM(hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser1, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser1) {
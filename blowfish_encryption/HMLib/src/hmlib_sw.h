@@ -0,0 +1,33 @@
+#ifndef HMLIB_SW_H
+#define HMLIB_SW_H
+
+//SOFTWARE BACKEND FOR HMLib. TWO HOST THREADS PER HANDLER PLAY memAccelerate ON THE SAME RING PROTOCOL AND
+//FEED HMLIB_PE_PER_HANDLER COPIES OF THE UNMODIFIED USER PE (blowfishPE, histogramPE, ...), EACH IN ITS OWN THREAD.
+//BUILD EVERY FILE THAT INCLUDES hls_stream.h WITH -DHLS_STREAM_THREAD_SAFE SO THE STREAMS BLOCK ACROSS THREADS
+#include <ap_axi_sdata.h>
+#include <ap_int.h>
+#include <hls_stream.h>
+
+#include "hmlib.h"
+
+//A USER PE AFTER ITS bufferData STAGE: READS THE CODE AND DATA LINES, WRITES THE RESULT PACKETS, RAISES stopSignal ON EXIT
+typedef void (*HMLibUserKernel)(hls::stream<ap_uint<512> >& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal);
+
+class HMLibSoftwareDevice : public HMLibDevice{
+	private:
+		HMLibUserKernel userKernel;
+		std::thread ringServers[HMLIB_HANDLERS];
+		bool started[HMLIB_HANDLERS];
+
+		void serveRing(char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize);
+		void retireRing(char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize, hls::stream<ap_axiu<514,0,0,0> >* fromUser, hls::stream<ap_uint<512> >& dispatched);
+	public:
+		HMLibSoftwareDevice(HMLibUserKernel kernel);
+		~HMLibSoftwareDevice();
+
+		bool start(const unsigned int handler, char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize);
+		void finish();
+		std::string name();
+};
+
+#endif
@@ -1,4 +1,3 @@
-#include "xcl2.hpp"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -17,6 +16,10 @@
 #include <sys/mman.h>
 
 #include "helpers.h"
+#ifdef HMLIB_SOFTWARE
+#include "hmlib_sw.h"
+void blowfish_SW(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal);
+#endif
 
 #include <fstream>
 #include <iostream>
@@ -26,26 +29,189 @@
 #define INPUT_FILE_PATH "../inputs/plaintext.txt" // input file path
 #define OUTPUT_FILE_PATH "../results/timing_results.txt" // output size in bytes
 
-uint32_t crc32_for_byte(uint32_t r){
-	for(int j = 0; j < 8; j++){
-		r = (r & 1? 0: (uint32_t)0xEDB88320L) ^ r >> 1;
+//KEY TABLE ENTRIES IN EVERY BLOWFISH PE. MUST MATCH BLOWFISH_KEYS IN blowfish.cpp
+#ifndef BLOWFISH_KEYS
+#define BLOWFISH_KEYS 4
+#endif
+//CODE OF THE BLOWFISH PE THAT LOADS A KEY, THE ARGUMENT IS THE TABLE ENTRY
+#define BLOWFISH_LOAD_KEY 3
+#define BLOWFISH_MAX_KEY_SIZE 56
+//MODE IN BITS 8-9 OF THE ARGUMENT. WITH RESTART (BIT 10) EVERY REQUEST IS A STREAM OF ITS OWN THAT STARTS FROM THE OPERAND
+#define BLOWFISH_MODE_ECB 0
+#define BLOWFISH_MODE_CBC 1
+#define BLOWFISH_MODE_CTR 2
+#define BLOWFISH_RESTART (1 << 10)
+//BIT 11 OF THE ARGUMENT DECRYPTS, WITH THE SAME KEY, MODE AND OPERAND THE INPUT WAS ENCRYPTED WITH
+#define BLOWFISH_DECRYPT (1 << 11)
+//STREAM ID IN BITS 16-23 OF THE ARGUMENT, EVERY PE KEEPS THE CHAIN OF EACH STREAM BETWEEN REQUESTS
+#define BLOWFISH_STREAM(s) ((uint32_t)(s) << 16)
+//INPUTS OF EVERY HANDLER THE ROUND TRIP CHECK (enable check 2) AND THE SPLIT STREAM CHECK (enable check 3) SEND
+#define ROUND_TRIP_INPUTS 8
+//ANY NON-ZERO AFFINITY PINS THE PIECES OF A SPLIT STREAM TO ONE PE, WHICH HOLDS THE CHAIN
+#define SPLIT_STREAM_AFFINITY 1
+
+
+
+//ONE KEY PER TENANT, TENANT k ENCRYPTS WITH KEY ID k
+std::string tenantKey(unsigned int k){
+	return "tenant " + std::to_string(k) + " key";
+}
+
+//PUTS EVERY TENANT KEY INTO THE KEY TABLE OF EVERY PE OF THE HANDLER. THE KERNEL RESTARTS WITH THE BUILT-IN KEY AFTER reconfigure
+bool loadTenantKeys(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH){
+	for(unsigned int k = 0; k < BLOWFISH_KEYS; k++){
+		std::string key = tenantKey(k);
+		if(key.size() == 0 || key.size() > BLOWFISH_MAX_KEY_SIZE){
+			std::cout << "Key " << k << " must be 1 to " << BLOWFISH_MAX_KEY_SIZE << " bytes" << std::endl;
+			return false;
+		}
+		if(HMLibObject.sendControl(key.data(), key.size(), BLOWFISH_LOAD_KEY, k, (uint64_t)30*1000*1000*1000, HMLibUH) != 0){
+			std::cout << "Could not load key " << k << " on handler " << HMLibUH->HMLibID << std::endl;
+			return false;
+		}
 	}
-	return r ^ (uint32_t)0xFF000000L;
+	return true;
 }
 
-uint32_t crc32(const void *data, size_t n_bytes){
-	uint32_t table[256];
-	uint32_t crc = 0;
+//ENCRYPTS THE FIRST ROUND_TRIP_INPUTS INPUTS ONE BY ONE, DECRYPTS THE CIPHERTEXT AGAIN AND COMPARES IT WITH THE INPUT.
+//THE WHOLE PADDED LAST LINE OF THE CIPHERTEXT IS SENT BACK, ITS BLOCKS ARE ONLY DECRYPTED RIGHT IN FULL
+bool roundTripCheck(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& sizes, const uint32_t modeFlags){
+	uint64_t timeout = (uint64_t)30*1000*1000*1000;
+	std::vector<char> cipherText;
+
+	for(unsigned int n = 0; n < inputs.size() && n < ROUND_TRIP_INPUTS; n++){
+		uint32_t argument = (n % BLOWFISH_KEYS) | (modeFlags & 0x300) | BLOWFISH_RESTART;
+		uint64_t iv = ((uint64_t)(n+1) << 32) | HMLibUH->HMLibID;
+		unsigned int paddedSize = customRound(sizes[n], 64);
+
+		for(unsigned int direction = 0; direction < 2; direction++){
+			const char* buffer[MAX_BATCH_SIZE] = {(direction == 0) ? inputs[n] : cipherText.data()};
+			unsigned int bufferSizes[MAX_BATCH_SIZE] = {(direction == 0) ? sizes[n] : paddedSize, 0, 0, 0};
+			unsigned int batched = 0;
+			if(HMLibObject.sendInput(buffer, bufferSizes, 1, batched, 2, timeout, HMLibUH, HMLIB_PRIORITY_NORMAL, argument | (direction * BLOWFISH_DECRYPT), iv) != 0){
+				std::cout << "Round trip: could not send input " << n << " on handler " << HMLibUH->HMLibID << std::endl;
+				return false;
+			}
+
+			char* outPtr[MAX_BATCH_SIZE];
+			unsigned int outSizes[MAX_BATCH_SIZE];
+			unsigned int batchCount = 0;
+			if(HMLibObject.peekOutput(outPtr, outSizes, batchCount, timeout, HMLibUH) != 0){
+				std::cout << "Round trip: no output for input " << n << " on handler " << HMLibUH->HMLibID << std::endl;
+				return false;
+			}
+
+			bool match = true;
+			if(direction == 0){
+				cipherText.assign(outPtr[0], outPtr[0] + paddedSize);
+			}else{
+				match = (memcmp(outPtr[0], inputs[n], sizes[n]) == 0);
+			}
+			HMLibObject.releaseOutput(HMLibUH);
 
-	for(uint32_t i = 0; i < 256; i++){
-		table[i] = crc32_for_byte(i);
+			if(!match){
+				std::cout << "Round trip: input " << n << " on handler " << HMLibUH->HMLibID << " does not decrypt back to itself" << std::endl;
+				return false;
+			}
+		}
 	}
-	for(uint32_t i = 0; i < n_bytes; i++){
-		crc = table[(uint8_t)crc ^ ((uint8_t*)data)[i]] ^ crc >> 8;
+	return true;
+}
+
+//SENDS input AS ONE REQUEST PER PIECE OF pieceSizes ON THE STREAM IN argument, RESTARTING IT FROM iv ONLY WITH THE FIRST PIECE,
+//AND COLLECTS THE OUTPUTS OF THE PIECES IN output
+bool streamPieces(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const char* input, const std::vector<unsigned int>& pieceSizes, const uint32_t argument, const uint64_t iv, std::vector<char>& output){
+	uint64_t timeout = (uint64_t)30*1000*1000*1000;
+	unsigned int offset = 0;
+	output.clear();
+
+	for(unsigned int p = 0; p < pieceSizes.size(); p++){
+		const char* buffer[MAX_BATCH_SIZE] = {input + offset};
+		unsigned int bufferSizes[MAX_BATCH_SIZE] = {pieceSizes[p], 0, 0, 0};
+		unsigned int batched = 0;
+		uint32_t restart = (p == 0) ? BLOWFISH_RESTART : 0;
+		if(HMLibObject.sendInput(buffer, bufferSizes, 1, batched, 2, timeout, HMLibUH, HMLIB_PRIORITY_NORMAL, argument | restart, iv, SPLIT_STREAM_AFFINITY) != 0){
+			std::cout << "Split stream: could not send piece " << p << " on handler " << HMLibUH->HMLibID << std::endl;
+			return false;
+		}
+
+		char* outPtr[MAX_BATCH_SIZE];
+		unsigned int outSizes[MAX_BATCH_SIZE];
+		unsigned int batchCount = 0;
+		if(HMLibObject.peekOutput(outPtr, outSizes, batchCount, timeout, HMLibUH) != 0){
+			std::cout << "Split stream: no output for piece " << p << " on handler " << HMLibUH->HMLibID << std::endl;
+			return false;
+		}
+		output.insert(output.end(), outPtr[0], outPtr[0] + pieceSizes[p]);
+		HMLibObject.releaseOutput(HMLibUH);
+
+		offset += pieceSizes[p];
 	}
-	return crc;
+	return true;
 }
 
+//ENCRYPTS EACH OF THE FIRST ROUND_TRIP_INPUTS INPUTS AS ONE REQUEST AND AGAIN AS TWO REQUESTS OF ONE STREAM, SPLIT AT A BLOCK
+//BOUNDARY THAT IS NOT A MULTIPLE OF 64 BYTES, SO THE FIRST REQUEST ENDS IN A PARTLY FILLED LINE. BOTH CIPHERTEXTS MUST MATCH,
+//AND THE SPLIT ONE MUST DECRYPT BACK TO THE INPUT WHEN IT IS SENT IN THE SAME PIECES
+bool splitStreamCheck(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& sizes, const uint32_t modeFlags){
+	std::vector<char> wholeText, splitText, plainText;
+
+	for(unsigned int n = 0; n < inputs.size() && n < ROUND_TRIP_INPUTS; n++){
+		uint32_t argument = (n % BLOWFISH_KEYS) | (modeFlags & 0x300) | BLOWFISH_STREAM(n);
+		uint64_t iv = ((uint64_t)(n+1) << 32) | HMLibUH->HMLibID;
+		unsigned int first = customRound(sizes[n] / 2, 8);
+		if(first % 64 == 0){
+			first += 8;
+		}
+		if(sizes[n] % 8 != 0 || first >= sizes[n]){
+			continue;
+		}
+		std::vector<unsigned int> pieces = {first, sizes[n] - first};
+
+		if(!streamPieces(HMLibObject, HMLibUH, inputs[n], {sizes[n]}, argument, iv, wholeText) ||
+			!streamPieces(HMLibObject, HMLibUH, inputs[n], pieces, argument, iv, splitText) ||
+			!streamPieces(HMLibObject, HMLibUH, splitText.data(), pieces, argument | BLOWFISH_DECRYPT, iv, plainText)){
+			return false;
+		}
+
+		if(wholeText != splitText){
+			std::cout << "Split stream: input " << n << " on handler " << HMLibUH->HMLibID << " encrypts differently when split at " << first << " bytes" << std::endl;
+			return false;
+		}
+		if(memcmp(plainText.data(), inputs[n], sizes[n]) != 0){
+			std::cout << "Split stream: input " << n << " on handler " << HMLibUH->HMLibID << " does not decrypt back to itself when split at " << first << " bytes" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+//MIXED SIZE INPUTS (enable check 4) ARE RETIRED AS THEY FINISH AND answers HOLDS THE CRC OF EACH OUTPUT AT THE INDEX OF ITS INPUT.
+//SENDS THE SAME INPUTS AGAIN WITH THE SAME ARGUMENTS, RETIRED IN ORDER, AND COMPARES THE CRC OF EVERY OUTPUT
+bool inOrderCheck(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& sizes, const std::vector<unsigned int>& answers, const unsigned int arguments, const uint32_t modeFlags){
+	std::vector<unsigned int> inOrderAnswers;
+	bool pass[2];
+	std::thread sender(parallelTaskSend, std::ref(HMLibObject), HMLibUH, std::ref(inputs), std::ref(sizes), std::ref(pass[0]), arguments, modeFlags);
+	std::thread receiver(parallelTaskReceive, std::ref(HMLibObject), HMLibUH, std::ref(inOrderAnswers), inputs.size(), true, std::ref(pass[1]), false);
+	sender.join();
+	receiver.join();
+	if(!pass[0] || !pass[1]){
+		std::cout << "In order: could not resend the inputs of handler " << HMLibUH->HMLibID << std::endl;
+		return false;
+	}
+
+	if(answers.size() != inOrderAnswers.size()){
+		std::cout << "In order: handler " << HMLibUH->HMLibID << " returned " << answers.size() << " outputs out of order and " << inOrderAnswers.size() << " in order" << std::endl;
+		return false;
+	}
+	for(unsigned int n = 0; n < answers.size(); n++){
+		if(answers[n] != inOrderAnswers[n]){
+			std::cout << "In order: input " << n << " on handler " << HMLibUH->HMLibID << " encrypts to " << answers[n] << " out of order and " << inOrderAnswers[n] << " in order" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
 
 int crc_test(int argc, char* argv[]){
 
@@ -65,10 +231,41 @@ int crc_test(int argc, char* argv[]){
     std::cout << "*****************************************" << std::endl;
 
 	std::string filePaths = std::string(argv[1]);
-	bool enableCheck = std::stoi(argv[3]);
+	//1 COMPARES CRCS, 2 DECRYPTS A FEW OUTPUTS OF EVERY HANDLER BACK AND COMPARES THEM WITH THEIR INPUTS,
+	//3 ALSO SENDS A FEW INPUTS AS STREAMS SPLIT OVER TWO REQUESTS AND COMPARES THEM WITH THE UNSPLIT CIPHERTEXT,
+	//4 MIXES INPUT SIZES AND RETIRES REQUESTS AS THEY FINISH, CHECKING THAT EVERY INPUT COMES BACK ONCE AND ENCRYPTS AS IT DOES IN ORDER
+	int checkMode = std::stoi(argv[3]);
+	bool enableCheck = (checkMode == 1);
+	bool roundTrip = (checkMode == 2 || checkMode == 3);
+	bool splitStream = (checkMode == 3);
+	bool anyOrder = (checkMode == 4);
+	unsigned int handlers = HMLIB_HANDLERS;
+	if(argc > 4){
+		handlers = std::stoi(argv[4]);
+	}
+	uint32_t modeFlags = BLOWFISH_MODE_ECB << 8;
+	if(argc > 5){
+		std::string mode = std::string(argv[5]);
+		if(mode == "cbc"){
+			modeFlags = (BLOWFISH_MODE_CBC << 8) | BLOWFISH_RESTART;
+		}else if(mode == "ctr"){
+			modeFlags = (BLOWFISH_MODE_CTR << 8) | BLOWFISH_RESTART;
+		}else if(mode != "ecb"){
+			std::cout << "Unknown mode " << mode << ", use ecb, cbc or ctr" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::cout << "Mode: " << mode << std::endl;
+	}
 
 	// store the end-to-end time for each input size
 	double end_to_end_time[NUM_INPUTSIZES] = {0.0};
+
+	//ONE SESSION FOR EVERY INPUT SIZE: THE DEVICE IS PROGRAMMED ONCE, reconfigure RE-CARVES THE RINGS PER SIZE
+	//THE DEVICE MUST OUTLIVE HMLibObject, ITS DESTRUCTOR WAITS FOR THE EXIT CODE
+	#ifdef HMLIB_SOFTWARE
+	HMLibSoftwareDevice softwareDevice(blowfish_SW);
+	#endif
+	HMLib HMLibObject;
 	
 	for (uint32_t curr_inputsize_index = 0; curr_inputsize_index < NUM_INPUTSIZES; curr_inputsize_index++){
 
@@ -162,7 +359,8 @@ int crc_test(int argc, char* argv[]){
 
 			// inFile.read(tmpPtr, inputSize);
 			fileData.push_back(tmpPtr);
-			fileSizes.push_back(inputSize);
+			//MIXED SIZES: FULL, 1/2, 1/4 AND 1/8 OF inputSize IN TURN, SO SHORT REQUESTS CAN FINISH AHEAD OF LONG ONES ON OTHER PEs
+			fileSizes.push_back(anyOrder ? std::max(inputSize >> (curr_loop % 4), (size_t)8) : inputSize);
 			// inFile.close();
 
 			// totalInputSize += inputSize;
@@ -180,33 +378,98 @@ int crc_test(int argc, char* argv[]){
 		std::thread workers[HMLIB_HANDLERS][2];
 		bool pass[HMLIB_HANDLERS][2];
 		struct HMLibUniqueHandler* HMLibUH[HMLIB_HANDLERS];
-		HMLib HMLibObject;
-		HMLibObject.initialize(std::string(argv[2]),"blowfish_HM",8,inputSize,outputSize);
+		//SMALL INPUTS GET SLOTS LARGE ENOUGH FOR MAX_BATCH_SIZE REQUESTS SO parallelTaskSend CAN BATCH THEM.
+		//A KERNEL BUILT FOR ONE RING GEOMETRY KEEPS IT, LARGER INPUTS THEN SPAN SEVERAL SLOTS
+		unsigned int sections = 8;
+		unsigned int slotInput = batchSlotSize(inputSize,inputSize);
+		unsigned int slotOutput = batchSlotSize(inputSize,outputSize);
+		#if HMLIB_FIXED_SECTIONS
+		sections = HMLIB_FIXED_SECTIONS;
+		slotInput = HMLIB_FIXED_INPUT_SIZE;
+		slotOutput = HMLIB_FIXED_OUTPUT_SIZE;
+		#endif
+		if(curr_inputsize_index == 0){
+			#ifdef HMLIB_SOFTWARE
+			if(!HMLibObject.initialize(&softwareDevice,sections,slotInput,slotOutput,handlers)){
+			#else
+			if(!HMLibObject.initialize(std::string(argv[2]),"blowfish_HM",sections,slotInput,slotOutput,handlers)){
+			#endif
+				exit(EXIT_FAILURE);
+			}
+		}else if(!HMLibObject.reconfigure(sections,slotInput,slotOutput,handlers)){
+			exit(EXIT_FAILURE);
+		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			HMLibUH[i] = HMLibObject.getHMLibUniqueHandler(i);
 			if(HMLibUH[i] == nullptr){
 				exit(EXIT_FAILURE);;
 			}
+			if(!loadTenantKeys(HMLibObject, HMLibUH[i])){
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		//SPLIT THE INPUTS INTO ONE CONTIGUOUS CHUNK PER HANDLER SO EACH SEND/RECEIVE PAIR OWNS ITS OWN RING
+		std::vector<char*> handlerData[HMLIB_HANDLERS];
+		std::vector<unsigned int> handlerSizes[HMLIB_HANDLERS];
+		std::vector<unsigned int> handlerAnswers[HMLIB_HANDLERS];
+		for(unsigned int i = 0; i < handlers; i++){
+			unsigned int first = (fileData.size() * i)/handlers;
+			unsigned int last = (fileData.size() * (i+1))/handlers;
+			handlerData[i].assign(fileData.begin()+first, fileData.begin()+last);
+			handlerSizes[i].assign(fileSizes.begin()+first, fileSizes.begin()+last);
+		}
+
+		//HANDLER i IS TENANT i % BLOWFISH_KEYS AND KEEPS ITS KEY FOR THE WHOLE RUN, SO ITS PEs ONLY LOAD THE KEY ON THE FIRST REQUEST.
+		//SWITCHING KEYS BETWEEN REQUESTS WOULD REFILL THE ENGINE EVERY TIME. THE ROUND TRIP AND SPLIT STREAM CHECKS STILL CYCLE THROUGH EVERY KEY
+		uint32_t tenantFlags[HMLIB_HANDLERS];
+		for(unsigned int i = 0; i < handlers; i++){
+			tenantFlags[i] = (i % BLOWFISH_KEYS) | modeFlags;
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-			workers[i][0] = std::thread(parallelTaskSend, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(fileData), std::ref(fileSizes), std::ref(pass[i][0]));
-			workers[i][1] = std::thread(parallelTaskReceive, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(crcFPGAAnswers), entryCount, enableCheck, std::ref(pass[i][1]));
+		for(unsigned int i = 0; i < handlers; i++){
+			workers[i][0] = std::thread(parallelTaskSend, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(handlerData[i]), std::ref(handlerSizes[i]), std::ref(pass[i][0]), 1, tenantFlags[i]);
+			workers[i][1] = std::thread(parallelTaskReceive, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(handlerAnswers[i]), handlerData[i].size(), enableCheck || anyOrder, std::ref(pass[i][1]), anyOrder);
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			for(unsigned int j = 0; j < 2; j++){
 				workers[i][j].join();
 			}
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			for(unsigned int j = 0; j < 2; j++){
 				if(!pass[i][j]){
 					exit(EXIT_FAILURE);
 				}
 			}
+			crcFPGAAnswers.insert(crcFPGAAnswers.end(), handlerAnswers[i].begin(), handlerAnswers[i].end());
+		}
+
+		if(roundTrip){
+			for(unsigned int i = 0; i < handlers; i++){
+				if(!roundTripCheck(HMLibObject, HMLibUH[i], handlerData[i], handlerSizes[i], modeFlags)){
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+
+		if(splitStream){
+			for(unsigned int i = 0; i < handlers; i++){
+				if(!splitStreamCheck(HMLibObject, HMLibUH[i], handlerData[i], handlerSizes[i], modeFlags)){
+					exit(EXIT_FAILURE);
+				}
+			}
+		}
+
+		if(anyOrder){
+			for(unsigned int i = 0; i < handlers; i++){
+				if(!inOrderCheck(HMLibObject, HMLibUH[i], handlerData[i], handlerSizes[i], handlerAnswers[i], 1, tenantFlags[i])){
+					exit(EXIT_FAILURE);
+				}
+			}
 		}
 
 		//TODO: WRITE YOUR GOLDEN ANSWER COMPARE HERE
@@ -225,7 +488,7 @@ int crc_test(int argc, char* argv[]){
 			}
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			if(!HMLibObject.returnHMLibUniqueHandler(HMLibUH[i],i)){
 				exit(EXIT_FAILURE);
 			}
@@ -282,8 +545,8 @@ int crc_test(int argc, char* argv[]){
 
 
 int main(int argc, char* argv[]){
-	if(argc != 4){
-		std::cout << "Usage: " << argv[0] << " <input path> <XCLBIN File> <enable check>" << std::endl;
+	if(argc < 4 || argc > 6){
+		std::cout << "Usage: " << argv[0] << " <input path> <XCLBIN File> <enable check, 2 for a round trip, 3 to also split streams, 4 for mixed sizes out of order> [handlers] [ecb|cbc|ctr]" << std::endl;
 		return EXIT_FAILURE;
 	}
 
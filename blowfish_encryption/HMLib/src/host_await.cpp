@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <iostream>
+
+#include "helpers.h"
+#include "hmlib_sw.h"
+void blowfish_SW(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal);
+
+//DRIVER FOR THE C++20 awaitOutput API ON THE SOFTWARE BACKEND: ONE COROUTINE PER HANDLER ENCRYPTS ITS INPUTS, DECRYPTS
+//THE CIPHERTEXT AGAIN AND COMPARES IT WITH THE INPUT, co_awaiting EVERY OUTPUT THROUGH THE REACTOR
+#if !defined(__cpp_impl_coroutine)
+#error "host_await.cpp uses coroutines, build it with -std=c++20"
+#endif
+
+#define AWAIT_REQUESTS 64 // inputs every handler sends through encryption and back
+#define AWAIT_INPUT_SIZE 4096 // input size in bytes
+//BIT 11 OF THE ARGUMENT DECRYPTS, WITH THE SAME KEY AND MODE THE INPUT WAS ENCRYPTED WITH
+#define BLOWFISH_DECRYPT (1 << 11)
+
+//FIRE AND FORGET COROUTINE, IT RUNS UNTIL ITS FIRST co_await ON THE CALLER AND FROM THEN ON ON THE REACTOR THREAD
+struct HMLibTask{
+	struct promise_type{
+		HMLibTask get_return_object(){ return {}; }
+		std::suspend_never initial_suspend(){ return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void(){}
+		void unhandled_exception(){ std::terminate(); }
+	};
+};
+
+//ONE REQUEST IN FLIGHT AT A TIME, THE HANDLER'S THREAD IS GIVEN BACK WHILE THE PE WORKS. pass IS SET BEFORE done COUNTS UP
+HMLibTask roundTrips(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, bool& pass, std::atomic<unsigned int>& done){
+	uint64_t timeout = (uint64_t)30*1000*1000*1000;
+	std::vector<char> cipherText(AWAIT_INPUT_SIZE);
+	pass = true;
+
+	for(unsigned int n = 0; n < inputs.size() && pass; n++){
+		for(unsigned int direction = 0; direction < 2 && pass; direction++){
+			const char* buffer[MAX_BATCH_SIZE] = {(direction == 0) ? inputs[n] : cipherText.data()};
+			unsigned int bufferSizes[MAX_BATCH_SIZE] = {AWAIT_INPUT_SIZE, 0, 0, 0};
+			unsigned int batched = 0;
+			if(HMLibObject.sendInput(buffer, bufferSizes, 1, batched, 2, timeout, HMLibUH, HMLIB_PRIORITY_NORMAL, direction * BLOWFISH_DECRYPT) != 0){
+				std::cout << "Await: could not send input " << n << " on handler " << HMLibUH->HMLibID << std::endl;
+				pass = false;
+				break;
+			}
+
+			co_await HMLibObject.awaitOutput(HMLibUH);
+
+			char* outPtr[MAX_BATCH_SIZE];
+			unsigned int outSizes[MAX_BATCH_SIZE];
+			unsigned int batchCount = 0;
+			if(HMLibObject.peekOutput(outPtr, outSizes, batchCount, timeout, HMLibUH) != 0){
+				std::cout << "Await: no output for input " << n << " on handler " << HMLibUH->HMLibID << std::endl;
+				pass = false;
+				break;
+			}
+			if(direction == 0){
+				memcpy(cipherText.data(), outPtr[0], AWAIT_INPUT_SIZE);
+			}else if(memcmp(outPtr[0], inputs[n], AWAIT_INPUT_SIZE) != 0){
+				std::cout << "Await: input " << n << " on handler " << HMLibUH->HMLibID << " does not decrypt back to itself" << std::endl;
+				pass = false;
+			}
+			HMLibObject.releaseOutput(HMLibUH);
+		}
+	}
+	done++;
+}
+
+int main(int argc, char* argv[]){
+	unsigned int handlers = HMLIB_HANDLERS;
+	if(argc > 1){
+		handlers = std::stoi(argv[1]);
+	}
+	if(handlers == 0 || handlers > HMLIB_HANDLERS){
+		std::cout << "Usage: " << argv[0] << " [handlers, 1 to " << HMLIB_HANDLERS << "]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "*****************************************" << std::endl;
+	std::cout << "Starting Blowfish awaitOutput (HMLib)" << std::endl;
+	std::cout << "*****************************************" << std::endl;
+
+	//THE DEVICE MUST OUTLIVE HMLibObject, ITS DESTRUCTOR WAITS FOR THE EXIT CODE
+	HMLibSoftwareDevice softwareDevice(blowfish_SW);
+	HMLib HMLibObject;
+	if(!HMLibObject.initialize(&softwareDevice, 8, AWAIT_INPUT_SIZE, AWAIT_INPUT_SIZE, handlers)){
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 generator(1);
+	std::vector<char*> handlerData[HMLIB_HANDLERS];
+	struct HMLibUniqueHandler* HMLibUH[HMLIB_HANDLERS];
+	for(unsigned int i = 0; i < handlers; i++){
+		HMLibUH[i] = HMLibObject.getHMLibUniqueHandler(i);
+		if(HMLibUH[i] == nullptr){
+			return EXIT_FAILURE;
+		}
+		for(unsigned int n = 0; n < AWAIT_REQUESTS; n++){
+			char* input = new char[AWAIT_INPUT_SIZE];
+			for(unsigned int j = 0; j < AWAIT_INPUT_SIZE; j++){
+				input[j] = generator();
+			}
+			handlerData[i].push_back(input);
+		}
+	}
+
+	if(!HMLibObject.startReactor()){
+		return EXIT_FAILURE;
+	}
+	bool pass[HMLIB_HANDLERS];
+	std::atomic<unsigned int> done(0);
+	for(unsigned int i = 0; i < handlers; i++){
+		roundTrips(HMLibObject, HMLibUH[i], handlerData[i], pass[i], done);
+	}
+	while(done < handlers){
+		std::this_thread::yield();
+	}
+	HMLibObject.stopReactor();
+
+	bool allPass = true;
+	for(unsigned int i = 0; i < handlers; i++){
+		allPass = allPass && pass[i];
+		if(!HMLibObject.returnHMLibUniqueHandler(HMLibUH[i],i)){
+			allPass = false;
+		}
+		for(unsigned int n = 0; n < handlerData[i].size(); n++){
+			delete[] handlerData[i][n];
+		}
+	}
+
+	std::cout << "*****************************************" << std::endl;
+	std::cout << "Finished Blowfish awaitOutput (HMLib): " << (allPass ? "passed" : "failed") << std::endl;
+	std::cout << "*****************************************" << std::endl;
+	return allPass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,26 +1,108 @@
+
 #include "hmlib_top.h"
 
+//PE P OF HANDLER ID TALKS TO THE USER KERNEL ON STREAM PAIR K
+#define HM_PE_FROM_USER(ID, P, K) wrapperHostMemStrmFromUser(rerouteFromUser[ID][P], hostMemStrmFromUser##K);
+#define HM_PE_TO_USER(ID, P, K) wrapperHostMemStrmToUser(rerouteToUser[ID][P], hostMemStrmToUser##K, stopSignal[ID][P]);
+
+//STREAM PAIRS OF HANDLER ID, PE_PER_HANDLER OF THEM STARTING AT ID*PE_PER_HANDLER+1
+#if PE_PER_HANDLER == 1
+#define HM_PES(F, ID, K0, K1, K2, K3) F(ID, 0, K0)
+#define HM_PE_STREAMS_0 1, 0, 0, 0
+#define HM_PE_STREAMS_1 2, 0, 0, 0
+#define HM_PE_STREAMS_2 3, 0, 0, 0
+#define HM_PE_STREAMS_3 4, 0, 0, 0
+#elif PE_PER_HANDLER == 2
+#define HM_PES(F, ID, K0, K1, K2, K3) F(ID, 0, K0) F(ID, 1, K1)
+#define HM_PE_STREAMS_0 1, 2, 0, 0
+#define HM_PE_STREAMS_1 3, 4, 0, 0
+#define HM_PE_STREAMS_2 5, 6, 0, 0
+#define HM_PE_STREAMS_3 7, 8, 0, 0
+#else
+#define HM_PES(F, ID, K0, K1, K2, K3) F(ID, 0, K0) F(ID, 1, K1) F(ID, 2, K2) F(ID, 3, K3)
+#define HM_PE_STREAMS_0 1, 2, 3, 4
+#define HM_PE_STREAMS_1 5, 6, 7, 8
+#endif
+
+//ONE INSTANCE OF THE HOST MEMORY DATAFLOW PER HANDLER. HANDLER ID USES hostMemoryBufferUserN AND ITS PE STREAM PAIRS
+#define HM_HANDLER_PES(ID, N, K0, K1, K2, K3) \
+	HM_PES(HM_PE_FROM_USER, ID, K0, K1, K2, K3) \
+	wrapperUserHostMemPE<HMGeometry>(hostMemoryBufferUser##N, \
+		hostMemoryMetaUser##N, \
+		rerouteToUser[ID], \
+		rerouteFromUser[ID], \
+		stopSignal[ID], \
+		geometry); \
+	HM_PES(HM_PE_TO_USER, ID, K0, K1, K2, K3)
+#define HM_HANDLER_EXPAND(ID, N, KS) HM_HANDLER_PES(ID, N, KS)
+#define HM_HANDLER_INSTANCE(ID, N) HM_HANDLER_EXPAND(ID, N, HM_CAT(HM_PE_STREAMS_, ID))
+
 extern "C"{
 void memAccelerate(ap_uint<32> bufferSections,
 		ap_uint<32> dataInSectionSize,
 		ap_uint<32> dataOutSectionSize,
 
-		ap_uint<512>* hostMemoryBufferUser1,
+		HOST_MEM_BUFFER_DEF,
 
 		HOST_MEM_FROM_USER_STREAM_DEF,
 		HOST_MEM_TO_USER_STREAM_DEF){
 
-	#pragma HLS INTERFACE m_axi port=hostMemoryBufferUser1 num_read_outstanding=32 num_write_outstanding=32 offset=slave bundle=gmem1
-
+	#pragma HLS INTERFACE m_axi port=hostMemoryBufferUser1 num_read_outstanding=32 num_write_outstanding=32 max_read_burst_length=64 max_write_burst_length=64 offset=slave bundle=gmem1
 	#pragma HLS INTERFACE s_axilite port=hostMemoryBufferUser1 
+	#pragma HLS INTERFACE m_axi port=hostMemoryMetaUser1 num_read_outstanding=4 num_write_outstanding=1 max_read_burst_length=8 max_write_burst_length=2 offset=slave bundle=gmem1meta
+	#pragma HLS INTERFACE s_axilite port=hostMemoryMetaUser1
+#if HM_HANDLERS > 1
+	#pragma HLS INTERFACE m_axi port=hostMemoryBufferUser2 num_read_outstanding=32 num_write_outstanding=32 max_read_burst_length=64 max_write_burst_length=64 offset=slave bundle=gmem2
+	#pragma HLS INTERFACE s_axilite port=hostMemoryBufferUser2
+	#pragma HLS INTERFACE m_axi port=hostMemoryMetaUser2 num_read_outstanding=4 num_write_outstanding=1 max_read_burst_length=8 max_write_burst_length=2 offset=slave bundle=gmem2meta
+	#pragma HLS INTERFACE s_axilite port=hostMemoryMetaUser2
+#endif
+#if HM_HANDLERS > 2
+	#pragma HLS INTERFACE m_axi port=hostMemoryBufferUser3 num_read_outstanding=32 num_write_outstanding=32 max_read_burst_length=64 max_write_burst_length=64 offset=slave bundle=gmem3
+	#pragma HLS INTERFACE s_axilite port=hostMemoryBufferUser3
+	#pragma HLS INTERFACE m_axi port=hostMemoryMetaUser3 num_read_outstanding=4 num_write_outstanding=1 max_read_burst_length=8 max_write_burst_length=2 offset=slave bundle=gmem3meta
+	#pragma HLS INTERFACE s_axilite port=hostMemoryMetaUser3
+#endif
+#if HM_HANDLERS > 3
+	#pragma HLS INTERFACE m_axi port=hostMemoryBufferUser4 num_read_outstanding=32 num_write_outstanding=32 max_read_burst_length=64 max_write_burst_length=64 offset=slave bundle=gmem4
+	#pragma HLS INTERFACE s_axilite port=hostMemoryBufferUser4
+	#pragma HLS INTERFACE m_axi port=hostMemoryMetaUser4 num_read_outstanding=4 num_write_outstanding=1 max_read_burst_length=8 max_write_burst_length=2 offset=slave bundle=gmem4meta
+	#pragma HLS INTERFACE s_axilite port=hostMemoryMetaUser4
+#endif
+
 	#pragma HLS INTERFACE axis port=hostMemStrmFromUser1
 	#pragma HLS INTERFACE axis port=hostMemStrmToUser1
-
+#if MAX_PE > 1
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser2
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser2
+#endif
+#if MAX_PE > 2
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser3
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser3
+#endif
+#if MAX_PE > 3
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser4
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser4
+#endif
+#if MAX_PE > 4
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser5
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser5
+#endif
+#if MAX_PE > 5
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser6
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser6
+#endif
+#if MAX_PE > 6
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser7
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser7
+#endif
+#if MAX_PE > 7
+	#pragma HLS INTERFACE axis port=hostMemStrmFromUser8
+	#pragma HLS INTERFACE axis port=hostMemStrmToUser8
+#endif
 
 	#pragma HLS INTERFACE s_axilite port=return
-	ap_uint<32> DATA_OUT_SECTION_SIZE = dataOutSectionSize;
-	ap_uint<32> BUFFER_SECTIONS = bufferSections;
-	ap_uint<32> DATA_IN_SECTION_SIZE = dataInSectionSize;
+	const HMGeometry geometry(bufferSections, dataInSectionSize, dataOutSectionSize);
 
 	hls::stream<ap_uint<512> > rerouteToUser[HM_HANDLERS][PE_PER_HANDLER];
 	#pragma HLS stream variable=rerouteToUser depth=16
@@ -30,15 +112,15 @@ void memAccelerate(ap_uint<32> bufferSections,
 
 	#pragma HLS dataflow
 
-	wrapperHostMemStrmFromUser(rerouteFromUser[0][0], hostMemStrmFromUser1);
-
-	wrapperUserHostMemPE(hostMemoryBufferUser1,
-		rerouteToUser[0], 
-		rerouteFromUser[0],
-		stopSignal[0],
-		BUFFER_SECTIONS, DATA_IN_SECTION_SIZE, DATA_OUT_SECTION_SIZE);
-
-	wrapperHostMemStrmToUser(rerouteToUser[0][0], hostMemStrmToUser1, stopSignal[0][0]);
-	
+	HM_HANDLER_INSTANCE(0, 1)
+#if HM_HANDLERS > 1
+	HM_HANDLER_INSTANCE(1, 2)
+#endif
+#if HM_HANDLERS > 2
+	HM_HANDLER_INSTANCE(2, 3)
+#endif
+#if HM_HANDLERS > 3
+	HM_HANDLER_INSTANCE(3, 4)
+#endif
 }
 }
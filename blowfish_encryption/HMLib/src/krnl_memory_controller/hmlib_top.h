@@ -5,25 +5,202 @@
 #include <ap_int.h>
 #include <ap_utils.h>
 #include <hls_stream.h>
+#include <hls_burst_maxi.h>
 #include <iostream>
 
 #include <stdint.h>
 #include <math.h>
 #include <limits.h>
 	 
-#define HOST_MEM_FROM_USER_STREAM_DEF hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser1
-
-#define HOST_MEM_TO_USER_STREAM_DEF hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser1
-
 //functions to handle memory between host and streams(set exit, set mode)
 //SET PE TO EXIT code = 1
 //SET PE TO PROCESS code = 2
 
 #define BURST_LENGTH 8
 #define BURST_LENGTH_WRITE 1
-#define MAX_PE 1
-#define HM_HANDLERS 1
-#define PE_PER_HANDLER (MAX_PE/HM_HANDLERS)
+//DOORBELL BURST AFTER THE META SECTIONS, THE FIRST LINE IS THE DOORBELL. MUST MATCH HMLIB_DOORBELL_BYTES
+#define DOORBELL_LINES BURST_LENGTH
+//THE HIGH PRIORITY META SECTIONS FOLLOW THE DOORBELL BURST, THE INPUT SLOTS START AFTER THEM
+#define SLOT_OFFSET_LINES (DOORBELL_LINES+PRIORITY_SECTIONS)
+//LONGEST DATA BURST IN 64 B LINES, UP TO 64 (4 KB). READS ASK FOR WHAT IS LEFT OF A REQUEST UP TO THIS, WRITES GATHER
+//CONSECUTIVE OUTPUT LINES UP TO THIS. THE m_axi PORTS IN hmlib_top.cpp ALLOW 64
+#ifndef HM_DATA_BURST_LENGTH
+#define HM_DATA_BURST_LENGTH 64
+#endif
+#define DATA_BURST_LENGTH HM_DATA_BURST_LENGTH
+//WRITE BURSTS LEFT WITHOUT A RESPONSE BEFORE memoryHandlerWrite WAITS, MATCHES num_write_outstanding IN hmlib_top.cpp
+#define WRITE_OUTSTANDING 32
+//DATA READ BURSTS memoryHandleDataReads REQUESTS AHEAD, MATCHES num_read_outstanding IN hmlib_top.cpp
+#define READ_OUTSTANDING 32
+
+//HM_HANDLERS MUST MATCH HMLIB_HANDLERS IN helpers.h AND THE k2k.cfg CONNECTIVITY
+//EACH HANDLER HAS ITS OWN HOST MEMORY RING (hostMemoryBufferUserN) AND ITS OWN USER PE STREAMS
+#ifndef HM_HANDLERS
+#define HM_HANDLERS 2
+#endif
+//USER PEs BEHIND EACH HANDLER, MUST MATCH HMLIB_PE_PER_HANDLER IN helpers.h. REQUESTS GO TO THE PEs ROUND ROBIN, OR TO THE PE OF THEIR AFFINITY,
+//AND RETIRE AS THEY FINISH. PE P OF HANDLER ID USES STREAM PAIR ID*PE_PER_HANDLER+P+1
+#ifndef HM_PE_PER_HANDLER
+#define HM_PE_PER_HANDLER 1
+#endif
+#define PE_PER_HANDLER HM_PE_PER_HANDLER
+//1: pollMeta READS THE DOORBELL LINE AFTER THE RING AND ONLY FETCHES THE META LINES PUBLISHED SINCE THE LAST READ.
+//0: IT POLLS THE BURST HOLDING THE NEXT EXPECTED META LINE EVERY 32 CYCLES. THE HOST RINGS THE DOORBELL EITHER WAY
+#ifndef HM_DOORBELL
+#define HM_DOORBELL 1
+#endif
+//META SECTIONS OF A SECOND, HIGH PRIORITY RING (A MULTIPLE OF 8, 0 FOR NONE). pollMeta FETCHES ITS META LINES BEFORE
+//THOSE OF THE NORMAL RING, THE DOORBELL CARRIES ITS PROGRAM COUNTER IN BITS 32-63. MUST MATCH HMLIB_PRIORITY_SECTIONS
+#ifndef HM_PRIORITY_SECTIONS
+#define HM_PRIORITY_SECTIONS 0
+#endif
+#define PRIORITY_SECTIONS HM_PRIORITY_SECTIONS
+//0: STRICT PRIORITY. N: AFTER N HIGH PRIORITY FETCHES IN A ROW WITH NORMAL META LINES WAITING, ONE NORMAL FETCH GOES FIRST
+#ifndef HM_PRIORITY_WEIGHT
+#define HM_PRIORITY_WEIGHT 0
+#endif
+//HIGH PRIORITY PROGRAM COUNTERS COUNT UP FROM HERE SO THEY NEVER MATCH A NORMAL ONE. MUST MATCH HMLIB_PRIORITY_PC
+#define PRIORITY_PC 0x80000000
+#define META_RINGS (1+(PRIORITY_SECTIONS != 0))
+//1: THE HOST MAY SEND THE INPUTS OF A REQUEST AS ONE LZ4 BLOCK, unpackDataUser EXPANDS IT IN FRONT OF THE PEs. THE LINES
+//IT TAKES IN THE RING COME IN BITS 48-63 OF THE META LINE, 0 FOR A REQUEST SENT AS IS. MUST MATCH HMLIB_COMPRESS IN helpers.h.
+//IT EXPANDS AT MOST 8 BYTES A CYCLE, ABOUT 4 ON TEXT, FAR BELOW THE 64 OF A REQUEST SENT AS IS. IT ONLY PAYS OFF
+//WHEN THE HOST LINK, NOT THE PEs, LIMITS THE HANDLER
+#ifndef HM_COMPRESS
+#define HM_COMPRESS 0
+#endif
+//BYTES OF OUTPUT HISTORY unpackDataUser KEEPS, A POWER OF TWO. MATCHES NEVER REACH FURTHER BACK, MUST MATCH HMLIB_COMPRESS_WINDOW
+#ifndef HM_COMPRESS_WINDOW
+#define HM_COMPRESS_WINDOW 4096
+#endif
+//1: A REQUEST MAY BE SENT BY REFERENCE. ITS SLOT THEN ONLY HOLDS A DESCRIPTOR LINE OF UP TO 4 (LINE OFFSET, LINES) PAIRS
+//POINTING INTO REGISTERED HOST BUFFERS, THE COUNT COMES IN BITS 16-31 OF THE META LINE. MUST MATCH HMLIB_GATHER IN helpers.h
+#ifndef HM_GATHER
+#define HM_GATHER 0
+#endif
+#define GATHER_DESCRIPTORS 4
+//PROCESSES pollMeta HANDS EVERY META LINE TO: sendDataUser, receiveDataUser AND unpackDataUser
+#define META_CONSUMERS (2+HM_COMPRESS)
+#define MAX_PE (HM_HANDLERS*PE_PER_HANDLER)
+
+#if HM_HANDLERS < 1 || HM_HANDLERS > 4
+#error "HM_HANDLERS must be between 1 and 4"
+#endif
+#if PE_PER_HANDLER != 1 && PE_PER_HANDLER != 2 && PE_PER_HANDLER != 4
+#error "HM_PE_PER_HANDLER must be 1, 2 or 4"
+#endif
+#if MAX_PE > 8
+#error "HM_HANDLERS*HM_PE_PER_HANDLER must be at most 8"
+#endif
+#if DATA_BURST_LENGTH < BURST_LENGTH || DATA_BURST_LENGTH > 64
+#error "HM_DATA_BURST_LENGTH must be between 8 and 64"
+#endif
+#if PRIORITY_SECTIONS % BURST_LENGTH != 0 || (PRIORITY_SECTIONS != 0 && !HM_DOORBELL)
+#error "HM_PRIORITY_SECTIONS must be a multiple of 8 and needs HM_DOORBELL=1"
+#endif
+#if HM_COMPRESS != 0 && HM_COMPRESS != 1
+#error "HM_COMPRESS must be 0 or 1"
+#endif
+#if HM_GATHER != 0 && HM_GATHER != 1
+#error "HM_GATHER must be 0 or 1"
+#endif
+#if HM_COMPRESS_WINDOW < 64 || (HM_COMPRESS_WINDOW & (HM_COMPRESS_WINDOW - 1)) != 0
+#error "HM_COMPRESS_WINDOW must be a power of two of at least 64"
+#endif
+
+//RING GEOMETRY FIXED AT BUILD TIME: META SECTIONS AND INPUT/OUTPUT SLOT SIZES IN 64 B LINES. MUST MATCH HMLIB_FIXED_*
+//IN helpers.h. THE SLOT ADDRESS MULTIPLIES THEN FOLD INTO CONSTANTS (SHIFTS FOR POWERS OF TWO) AND THE memAccelerate
+//GEOMETRY ARGUMENTS ARE IGNORED. 0 TAKES THE GEOMETRY FROM THE ARGUMENTS AT RUN TIME
+#ifndef HM_FIXED_SECTIONS
+#define HM_FIXED_SECTIONS 0
+#endif
+#ifndef HM_FIXED_IN_LINES
+#define HM_FIXED_IN_LINES 0
+#endif
+#ifndef HM_FIXED_OUT_LINES
+#define HM_FIXED_OUT_LINES 0
+#endif
+#if HM_FIXED_SECTIONS && (HM_FIXED_SECTIONS % BURST_LENGTH != 0 || HM_FIXED_IN_LINES == 0 || HM_FIXED_OUT_LINES == 0)
+#error "HM_FIXED_SECTIONS must be a multiple of 8 and needs HM_FIXED_IN_LINES and HM_FIXED_OUT_LINES"
+#endif
+
+//MAX_PE AS A SINGLE TOKEN FOR THE STREAM ARGUMENT LISTS BELOW
+#if MAX_PE == 1
+#define HM_USER_PES 1
+#elif MAX_PE == 2
+#define HM_USER_PES 2
+#elif MAX_PE == 3
+#define HM_USER_PES 3
+#elif MAX_PE == 4
+#define HM_USER_PES 4
+#elif MAX_PE == 6
+#define HM_USER_PES 6
+#else
+#define HM_USER_PES 8
+#endif
+
+#define HM_CAT_(a,b) a##b
+#define HM_CAT(a,b) HM_CAT_(a,b)
+
+//EVERY HANDLER GETS TWO m_axi MASTERS ON THE SAME RING: hostMemoryBufferUserN FOR DATA READS AND ALL WRITES,
+//hostMemoryMetaUserN FOR META AND DOORBELL READS. THE HOST PASSES THE SAME BUFFER TO BOTH
+#define HOST_MEM_BUFFER_DEF_1 hls::burst_maxi<ap_uint<512> > hostMemoryBufferUser1, hls::burst_maxi<ap_uint<512> > hostMemoryMetaUser1
+#define HOST_MEM_BUFFER_DEF_2 HOST_MEM_BUFFER_DEF_1, hls::burst_maxi<ap_uint<512> > hostMemoryBufferUser2, hls::burst_maxi<ap_uint<512> > hostMemoryMetaUser2
+#define HOST_MEM_BUFFER_DEF_3 HOST_MEM_BUFFER_DEF_2, hls::burst_maxi<ap_uint<512> > hostMemoryBufferUser3, hls::burst_maxi<ap_uint<512> > hostMemoryMetaUser3
+#define HOST_MEM_BUFFER_DEF_4 HOST_MEM_BUFFER_DEF_3, hls::burst_maxi<ap_uint<512> > hostMemoryBufferUser4, hls::burst_maxi<ap_uint<512> > hostMemoryMetaUser4
+
+#define HOST_MEM_FROM_USER_STREAM_DEF_1 hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser1
+#define HOST_MEM_FROM_USER_STREAM_DEF_2 HOST_MEM_FROM_USER_STREAM_DEF_1, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser2
+#define HOST_MEM_FROM_USER_STREAM_DEF_3 HOST_MEM_FROM_USER_STREAM_DEF_2, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser3
+#define HOST_MEM_FROM_USER_STREAM_DEF_4 HOST_MEM_FROM_USER_STREAM_DEF_3, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser4
+#define HOST_MEM_FROM_USER_STREAM_DEF_5 HOST_MEM_FROM_USER_STREAM_DEF_4, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser5
+#define HOST_MEM_FROM_USER_STREAM_DEF_6 HOST_MEM_FROM_USER_STREAM_DEF_5, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser6
+#define HOST_MEM_FROM_USER_STREAM_DEF_7 HOST_MEM_FROM_USER_STREAM_DEF_6, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser7
+#define HOST_MEM_FROM_USER_STREAM_DEF_8 HOST_MEM_FROM_USER_STREAM_DEF_7, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser8
+
+#define HOST_MEM_TO_USER_STREAM_DEF_1 hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser1
+#define HOST_MEM_TO_USER_STREAM_DEF_2 HOST_MEM_TO_USER_STREAM_DEF_1, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser2
+#define HOST_MEM_TO_USER_STREAM_DEF_3 HOST_MEM_TO_USER_STREAM_DEF_2, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser3
+#define HOST_MEM_TO_USER_STREAM_DEF_4 HOST_MEM_TO_USER_STREAM_DEF_3, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser4
+#define HOST_MEM_TO_USER_STREAM_DEF_5 HOST_MEM_TO_USER_STREAM_DEF_4, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser5
+#define HOST_MEM_TO_USER_STREAM_DEF_6 HOST_MEM_TO_USER_STREAM_DEF_5, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser6
+#define HOST_MEM_TO_USER_STREAM_DEF_7 HOST_MEM_TO_USER_STREAM_DEF_6, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser7
+#define HOST_MEM_TO_USER_STREAM_DEF_8 HOST_MEM_TO_USER_STREAM_DEF_7, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser8
+
+#define HOST_MEM_BUFFER_DEF HM_CAT(HOST_MEM_BUFFER_DEF_, HM_HANDLERS)
+#define HOST_MEM_FROM_USER_STREAM_DEF HM_CAT(HOST_MEM_FROM_USER_STREAM_DEF_, HM_USER_PES)
+#define HOST_MEM_TO_USER_STREAM_DEF HM_CAT(HOST_MEM_TO_USER_STREAM_DEF_, HM_USER_PES)
+
+//GEOMETRY SEEN BY pollMeta AND receiveDataUser, PENDING_META IS THE DEPTH OF EACH PE'S QUEUE OF META LINES IN FLIGHT
+struct HMRuntimeGeometry{
+	static const unsigned int PENDING_META = 16;
+	ap_uint<32> bufferSections;
+	ap_uint<32> dataInSectionSize;
+	ap_uint<32> dataOutSectionSize;
+
+	HMRuntimeGeometry(ap_uint<32> sections, ap_uint<32> inLines, ap_uint<32> outLines)
+		: bufferSections(sections), dataInSectionSize(inLines), dataOutSectionSize(outLines){}
+	ap_uint<32> sections() const { return bufferSections; }
+	ap_uint<32> inLines() const { return dataInSectionSize; }
+	ap_uint<32> outLines() const { return dataOutSectionSize; }
+};
+
+//NO MORE THAN SECTIONS META LINES ARE EVER IN FLIGHT, SO A SMALL RING ALSO GETS SMALL QUEUES
+template<unsigned int SECTIONS, unsigned int IN_LINES, unsigned int OUT_LINES>
+struct HMFixedGeometry{
+	static const unsigned int PENDING_META = (SECTIONS + PE_PER_HANDLER - 1)/PE_PER_HANDLER < 16 ? (SECTIONS + PE_PER_HANDLER - 1)/PE_PER_HANDLER : 16;
+
+	HMFixedGeometry(ap_uint<32> sections, ap_uint<32> inLines, ap_uint<32> outLines){}
+	ap_uint<32> sections() const { return SECTIONS; }
+	ap_uint<32> inLines() const { return IN_LINES; }
+	ap_uint<32> outLines() const { return OUT_LINES; }
+};
+
+#if HM_FIXED_SECTIONS
+typedef HMFixedGeometry<HM_FIXED_SECTIONS, HM_FIXED_IN_LINES, HM_FIXED_OUT_LINES> HMGeometry;
+#else
+typedef HMRuntimeGeometry HMGeometry;
+#endif
 
 struct writeOutPkt{
 	ap_uint<32> addr;
@@ -36,40 +213,52 @@ struct handleMemPkt{
 	ap_uint<1> stop;
 };
 
+//addr IS A LINE OFFSET FROM THE RING. A GATHER READ (HM_GATHER) POINTS AT THE DESCRIPTOR LINE, ITS OFFSETS REACH OTHER
+//HOST BUFFERS BY WRAPPING AROUND 64 BITS
 struct readPktReq{
-	ap_uint<32> addr;
+	ap_uint<64> addr;
 	ap_uint<64> size;
 	ap_uint<1> stop;
+	ap_uint<3> gather;
 };
 
-void memoryHandlerWrite(hls::stream<struct writeOutPkt>& pkt, ap_uint<512>* hostMemoryBuffer, 
-	hls::stream<ap_uint<64>>& time, hls::stream<bool>& alarm, hls::stream<ap_uint<32>>& testStream);
+void memoryHandlerWrite(hls::stream<struct writeOutPkt>& pkt, hls::burst_maxi<ap_uint<512> > hostMemoryBuffer, 
+	hls::stream<ap_uint<32>>& testStream);
 void cycleCounter(hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& outputCycle);
-void sleepTimer(hls::stream<ap_uint<64>>& time, hls::stream<bool>& alarm);
-void memoryHandleReadRequests(ap_uint<512>* hostMemorySection, 
+void memoryHandleMetaReads(hls::burst_maxi<ap_uint<512> > hostMemoryMeta, 
 	hls::stream<struct readPktReq>& readRequestMeta, 
+	hls::stream<ap_uint<512>>& valueResponseMeta);
+void memoryHandleDataReads(hls::burst_maxi<ap_uint<512> > hostMemorySection, 
 	hls::stream<struct readPktReq>& readRequestData, 
-	hls::stream<ap_uint<512>>& valueResponseMeta,
 	hls::stream<ap_uint<512>>& valueResponseData);
+template<typename GEOMETRY>
 void pollMeta(hls::stream<struct readPktReq>& readRequestMeta, 
 	hls::stream<struct readPktReq>& readRequestData,
 	hls::stream<ap_uint<512>>& valueMeta, 
-	hls::stream<ap_uint<512>> toProcTask[2], 
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE, const ap_uint<32> DATA_OUT_SECTION_SIZE,
+	hls::stream<ap_uint<512>> toProcTask[META_CONSUMERS], 
+	const GEOMETRY geometry,
 	hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& outputCycle, hls::stream<ap_uint<32>>& testStream);
+#if HM_COMPRESS
+void unpackDataUser(hls::stream<ap_uint<512>>& valueData,
+	hls::stream<ap_uint<512>>& fromWaitTask,
+	hls::stream<ap_uint<512>>& unpackedData);
+#endif
 void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 	hls::stream<ap_uint<512>>& fromWaitTask,
 	hls::stream<ap_uint<512> > rerouteToUser[PE_PER_HANDLER]);
+template<typename GEOMETRY>
 void receiveDataUser(hls::stream<struct writeOutPkt>& outPktData,
-	hls::stream<ap_uint<512>> fromWaitTask[2],
+	hls::stream<ap_uint<512>>& fromWaitTask,
 	hls::stream<ap_uint<513> > rerouteFromUser[PE_PER_HANDLER],
 	hls::stream<bool> stopSignalReroute[PE_PER_HANDLER],
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE, const ap_uint<32> DATA_OUT_SECTION_SIZE);
-void wrapperUserHostMemPE(ap_uint<512>* hostMemorySection,
+	const GEOMETRY geometry);
+template<typename GEOMETRY>
+void wrapperUserHostMemPE(hls::burst_maxi<ap_uint<512> > hostMemorySection,
+	hls::burst_maxi<ap_uint<512> > hostMemoryMeta,
 	hls::stream<ap_uint<512> > rerouteToUser[PE_PER_HANDLER],
 	hls::stream<ap_uint<513> > rerouteFromUser[PE_PER_HANDLER],
 	hls::stream<bool> stopSignal[PE_PER_HANDLER],
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE, const ap_uint<32> DATA_OUT_SECTION_SIZE);
+	const GEOMETRY geometry);
 void wrapperHostMemStrmToUser(hls::stream<ap_uint<512> >& rerouteToUser, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser, hls::stream<bool>& stopSignal);
 void wrapperHostMemStrmFromUser(hls::stream<ap_uint<513> >& rerouteFromUser, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser);
 
@@ -504,7 +504,7 @@ void krnl_blowfish(uint8_t* plainText, int inputLength, uint8_t* cipherText)
 				data[inputLength];
 
         // default key and hardcoded
-        char key[] = "the key is you";
+        char key[KEYSIZE] = "the key is you";
 
 		if(VERBOSE)
 			printf("plainText data: %s\n", plainText);
@@ -517,7 +517,13 @@ void krnl_blowfish(uint8_t* plainText, int inputLength, uint8_t* cipherText)
         memset(plainText + Osize, Pbyte, sizeof *plainText * Pbyte);
         memset(key + KOsize, KPbyte, sizeof *key * KPbyte);
 
-        blowfish_init(key, KPsize);
+        /* the key is fixed, so pbox/sbox (kept across calls) are expanded by the first call only.
+         * expanding them again would XOR the key into the previous schedule instead of the pi digits */
+        static int schedule_ready = 0;
+        if (!schedule_ready) {
+            blowfish_init(key, KPsize);
+            schedule_ready = 1;
+        }
         
         blowfish_encrypt(plainText, Psize, cipherText);
 		// cipherText = blowfish_encrypt(plainText, Psize);
@@ -14,9 +14,36 @@ LIB_EMU_TYPE=-lxrt_swemu
 VER=2022.2
 EN_PROF=""
 PLATFORM=xilinx_u250_gen3x16_xdma_4_1_202210_1
-
-source /opt/xilinx/xrt/setup.sh
-source /opt/xilinx/tools/Vitis_HLS/$VER/settings64.sh
+USER_KERNEL=histogram_HM
+# Number of HMLib handlers (host memory rings) built into the xclbin
+HANDLERS=2
+# User PE instances behind each handler (1, 2 or 4), at most 8 in total
+PES_PER_HANDLER=1
+USER_PES=$((HANDLERS * PES_PER_HANDLER))
+# 1: the kernel waits for the host's doorbell line before fetching meta lines, 0: it polls the ring
+DOORBELL=1
+# Longest host memory burst in 64 B lines (8 to 64)
+DATA_BURST=64
+# Ring geometry fixed at build time: sections and slot sizes in bytes (multiples of 64). 0 keeps it a run time choice
+FIXED_SECTIONS=0
+FIXED_INPUT_SIZE=0
+FIXED_OUTPUT_SIZE=0
+# 1: inputs that shrink by at least a line are sent as LZ4 blocks and expanded on the card
+COMPRESS=0
+# Meta sections of the high priority ring (a multiple of 8, needs DOORBELL=1). 0 builds without it
+PRIORITY_SECTIONS=0
+# High priority requests taken before one normal request is let through. 0: strict priority
+PRIORITY_WEIGHT=0
+# 1: inputs in registered host buffers can be sent by reference and are read by the kernel in place
+GATHER=0
+HOST_GEOMETRY="-DHMLIB_FIXED_SECTIONS=$FIXED_SECTIONS -DHMLIB_FIXED_INPUT_SIZE=$FIXED_INPUT_SIZE -DHMLIB_FIXED_OUTPUT_SIZE=$FIXED_OUTPUT_SIZE -DHMLIB_COMPRESS=$COMPRESS -DHMLIB_PRIORITY_SECTIONS=$PRIORITY_SECTIONS -DHMLIB_GATHER=$GATHER"
+
+# The software backend needs neither XRT nor the Vitis tools, only the HLS headers
+if [[ $COMMAND != sw ]]
+then
+	source /opt/xilinx/xrt/setup.sh
+	source /opt/xilinx/tools/Vitis_HLS/$VER/settings64.sh
+fi
 
 compile_opencl(){
 	LIB_EMU_TYPE=-lxrt_hwemu
@@ -37,6 +64,7 @@ compile_opencl(){
 	-Wall \
 	-O3 \
 	-DFPGA_DEVICE -DC_KERNEL $IS_HW_SIM \
+	-DHMLIB_HANDLERS=$HANDLERS -DHMLIB_PE_PER_HANDLER=$PES_PER_HANDLER $HOST_GEOMETRY \
 	-I/opt/xilinx/xrt/include \
 	-I/opt/xilinx \
 	-I/opt/xilinx/tools/Vitis_HLS/$VER/include \
@@ -62,6 +90,61 @@ compile_opencl(){
 	cd ../
 }
 
+compile_software(){
+	cd src
+	echo -e "${CY}Building the software backend (no FPGA, no xclbin, no XRT)... ${NC}"
+
+	(set -x; g++ -std=c++17 \
+	-Wall \
+	-O3 \
+	-DFPGA_DEVICE -DC_KERNEL -DHMLIB_SOFTWARE -DHLS_STREAM_THREAD_SAFE \
+	-DHMLIB_HANDLERS=$HANDLERS -DHMLIB_PE_PER_HANDLER=$PES_PER_HANDLER $HOST_GEOMETRY \
+	-I/opt/xilinx/tools/Vitis_HLS/$VER/include \
+	-Isrc \
+	-c host.cpp helpers.cpp hmlib.cpp hmlib_sw.cpp histogram.cpp)
+
+	if [ $? -ne 0 ]
+	then
+		echo -e "${RD}Software backend failed to compile ${NC}"
+		exit 1
+	fi
+
+	g++ -o test.sw.out host.o helpers.o hmlib.o hmlib_sw.o histogram.o -lpthread -lrt -lstdc++
+
+	if [ $? -ne 0 ]
+	then
+		echo -e "${RD}Software backend failed to link ${NC}"
+		exit 1
+	fi
+	cd ../
+}
+
+generate_connectivity(){
+	echo -e "${CY}Generating src/k2k.cfg for $HANDLERS handler(s), $PES_PER_HANDLER PE(s) each... ${NC}"
+	{
+		echo "[connectivity]"
+		echo "nk=$USER_KERNEL:$USER_PES"
+		echo "slr=memAccelerate_1:SLR2"
+		for (( i=1; i<=USER_PES; i++ ))
+		do
+			echo "slr=${USER_KERNEL}_$i:SLR2"
+		done
+		echo ""
+		# PE instance i serves stream pair i, handler h owns pairs h*PES_PER_HANDLER+1 onwards
+		for (( i=1; i<=USER_PES; i++ ))
+		do
+			echo "stream_connect=${USER_KERNEL}_$i.hostMemStrmFromUser1:memAccelerate_1.hostMemStrmFromUser$i"
+			echo "stream_connect=memAccelerate_1.hostMemStrmToUser$i:${USER_KERNEL}_$i.hostMemStrmToUser1"
+		done
+		echo ""
+		for (( i=1; i<=HANDLERS; i++ ))
+		do
+			echo "sp=memAccelerate_1.hostMemoryBufferUser$i:HOST[0]"
+			echo "sp=memAccelerate_1.hostMemoryMetaUser$i:HOST[0]"
+		done
+	} > src/k2k.cfg
+}
+
 compile_kernel(){
 	PIDS=""
 	FAIL=0
@@ -80,6 +163,9 @@ compile_kernel(){
 	echo -e "${CY}Running Vitis $EMU_TYPE make for HMLIB kernel... ${NC}"
 
 	(set -x; g++ -std=c++17 -w -O3 \
+	-DHM_HANDLERS=$HANDLERS -DHM_PE_PER_HANDLER=$PES_PER_HANDLER -DHM_DOORBELL=$DOORBELL -DHM_DATA_BURST_LENGTH=$DATA_BURST \
+	-DHM_FIXED_SECTIONS=$FIXED_SECTIONS -DHM_FIXED_IN_LINES=$((FIXED_INPUT_SIZE/64)) -DHM_FIXED_OUT_LINES=$((FIXED_OUTPUT_SIZE/64)) -DHM_COMPRESS=$COMPRESS \
+	-DHM_PRIORITY_SECTIONS=$PRIORITY_SECTIONS -DHM_PRIORITY_WEIGHT=$PRIORITY_WEIGHT -DHM_GATHER=$GATHER \
 	-I/opt/xilinx/xrt/include \
 	-I/opt/xilinx -I/opt/xilinx/tools/Vitis_HLS/$VER/include \
 	-Isrc \
@@ -96,6 +182,17 @@ compile_kernel(){
 	(set -x; v++ -c -t $EMU_TYPE \
 	--include src \
 	--include src/krnl_memory_controller \
+	--define HM_HANDLERS=$HANDLERS \
+	--define HM_PE_PER_HANDLER=$PES_PER_HANDLER \
+	--define HM_DOORBELL=$DOORBELL \
+	--define HM_DATA_BURST_LENGTH=$DATA_BURST \
+	--define HM_FIXED_SECTIONS=$FIXED_SECTIONS \
+	--define HM_FIXED_IN_LINES=$((FIXED_INPUT_SIZE/64)) \
+	--define HM_FIXED_OUT_LINES=$((FIXED_OUTPUT_SIZE/64)) \
+	--define HM_COMPRESS=$COMPRESS \
+	--define HM_PRIORITY_SECTIONS=$PRIORITY_SECTIONS \
+	--define HM_PRIORITY_WEIGHT=$PRIORITY_WEIGHT \
+	--define HM_GATHER=$GATHER \
 	$extraCommands \
 	--platform $PLATFORM \
 	-s --kernel memAccelerate \
@@ -115,7 +212,7 @@ compile_kernel(){
 	--include src \
 	$extraCommands \
 	--platform $PLATFORM \
-	-s --kernel histogram_HM \
+	-s --kernel $USER_KERNEL \
 	--kernel_frequency $FREQ \
 	-R2 \
 	src/histogram.cpp -o src/workload-histogram-$EMU_TYPE.xo) &
@@ -140,6 +237,7 @@ compile_kernel(){
 
 	########## LINK THE KERNELS TOGETHER ##########
 	echo -e "${CY}Running Vitis $EMU_TYPE link... ${NC}"
+	generate_connectivity
 
 	v++ -l $EN_PROF -t $EMU_TYPE \
 	--config src/k2k.cfg \
@@ -189,6 +287,21 @@ then
 	compile_opencl
 fi
 
+# ./runCompile.sh sw builds and runs HMLib against the software backend and compares every histogram with the CPU reference
+if [[ $COMMAND == sw ]]
+then
+	compile_software
+	cd src
+	./test.sw.out ../inputs/ none 1 $HANDLERS
+	if [ $? -ne 0 ]
+	then
+		echo -e "${RD}Error in the program ${NC}"
+		exit 1
+	fi
+	cd ../
+	exit 0
+fi
+
 if [[ $COMMAND == compilekernel ]]
 then
 	kill -9 $(pidof xsim)
@@ -227,6 +340,7 @@ fi
 
 if [[ $COMMAND == hw ]]
 then
+	generate_connectivity
 
 	v++ -l -t hw \
 	--config src/k2k.cfg \
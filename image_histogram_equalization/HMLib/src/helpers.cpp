@@ -7,12 +7,212 @@ unsigned int customRound(unsigned int valueToRound, unsigned int round){
 	return valueToRound;
 }
 
+//PACK CONSECUTIVE INPUTS STARTING AT first INTO ONE SLOT. EVERY INPUT IS ROUNDED UP TO A 64 BYTE LINE
+//SO SMALL REQUESTS SHARE ONE HANDSHAKE WHILE LARGE ONES STILL GO ALONE
+unsigned int batchInputs(const std::vector<unsigned int>& inputSizes, const unsigned int first, const unsigned int slotSize){
+	unsigned int batch = 0;
+	unsigned int packedSize = 0;
+	while(batch < MAX_BATCH_SIZE && first + batch < inputSizes.size()){
+		unsigned int nextSize = customRound(inputSizes[first+batch],64);
+		if(batch != 0 && packedSize + nextSize > slotSize){
+			break;
+		}
+		packedSize += nextSize;
+		batch++;
+	}
+	return batch;
+}
+
+//SIZE OF ONE RING SLOT FOR REQUESTS OF requestSize BYTES PRODUCING entrySize BYTES (INPUT OR OUTPUT)
+//SMALL REQUESTS GET ROOM FOR MAX_BATCH_SIZE ENTRIES SO parallelTaskSend CAN BATCH THEM
+unsigned int batchSlotSize(const unsigned int requestSize, const unsigned int entrySize){
+	if(requestSize <= BATCH_SLOT_LIMIT){
+		return customRound(entrySize,64) * MAX_BATCH_SIZE;
+	}
+	return customRound(entrySize,64);
+}
+
+//ONE LZ4 SEQUENCE: TOKEN, LITERALS AND (UNLESS matchLength IS 0, THE LAST SEQUENCE OF A BLOCK) THE MATCH
+static bool lz4Sequence(unsigned char* dst, unsigned int& position, const unsigned int capacity, const unsigned char* literals, unsigned int literalLength, const unsigned int offset, unsigned int matchLength){
+	unsigned int worstCase = 1 + literalLength/255 + 1 + literalLength + 2 + matchLength/255 + 1;
+	if(position + worstCase > capacity){
+		return false;
+	}
+
+	unsigned char* token = dst + position++;
+	*token = (literalLength >= 15 ? 15 : literalLength) << 4;
+	if(literalLength >= 15){
+		unsigned int rest = literalLength - 15;
+		for(; rest >= 255; rest -= 255){
+			dst[position++] = 255;
+		}
+		dst[position++] = rest;
+	}
+	memcpy(dst + position, literals, literalLength);
+	position += literalLength;
+
+	if(matchLength != 0){
+		dst[position++] = offset & 0xFF;
+		dst[position++] = offset >> 8;
+		matchLength -= 4;
+		*token |= (matchLength >= 15 ? 15 : matchLength);
+		if(matchLength >= 15){
+			unsigned int rest = matchLength - 15;
+			for(; rest >= 255; rest -= 255){
+				dst[position++] = 255;
+			}
+			dst[position++] = rest;
+		}
+	}
+	return true;
+}
+
+//GREEDY LZ4 BLOCK COMPRESSOR WITH A 4096 ENTRY HASH OF THE LAST POSITION EVERY 4 BYTE SEQUENCE WAS SEEN AT.
+//MATCHES REACH AT MOST HMLIB_COMPRESS_WINDOW BACK. RETURNS THE BLOCK SIZE, 0 WHEN IT DOES NOT FIT IN capacity
+unsigned int lz4Compress(const char* src, const unsigned int size, char* dst, const unsigned int capacity){
+	const unsigned char* in = (const unsigned char*)src;
+	unsigned char* out = (unsigned char*)dst;
+	unsigned int table[4096] = {0};
+	unsigned int position = 0;
+	unsigned int anchor = 0;
+	unsigned int current = 0;
+
+	//THE FORMAT ENDS EVERY BLOCK WITH AT LEAST 5 LITERALS AND STARTS NO MATCH IN THE LAST 12 BYTES
+	if(size > 12){
+		const unsigned int matchLimit = size - 12;
+		const unsigned int lastLiterals = size - 5;
+		while(current < matchLimit){
+			uint32_t sequence;
+			uint32_t candidate;
+			memcpy(&sequence, in + current, 4);
+			unsigned int hash = (sequence * 2654435761u) >> 20;
+			unsigned int reference = table[hash];
+			table[hash] = current;
+			memcpy(&candidate, in + reference, 4);
+
+			if(reference >= current || current - reference > HMLIB_COMPRESS_WINDOW || candidate != sequence){
+				current++;
+				continue;
+			}
+
+			unsigned int matchLength = 4;
+			while(current + matchLength < lastLiterals && in[reference + matchLength] == in[current + matchLength]){
+				matchLength++;
+			}
+			if(!lz4Sequence(out, position, capacity, in + anchor, current - anchor, current - reference, matchLength)){
+				return 0;
+			}
+			current += matchLength;
+			anchor = current;
+		}
+	}
+
+	if(!lz4Sequence(out, position, capacity, in + anchor, size - anchor, 0, 0)){
+		return 0;
+	}
+	return position;
+}
+
+//EXPANDS AN LZ4 BLOCK INTO EXACTLY size BYTES. RETURNS false FOR A BLOCK THAT READS OR WRITES OUT OF BOUNDS
+bool lz4Decompress(const char* src, const unsigned int packedSize, char* dst, const unsigned int size){
+	const unsigned char* in = (const unsigned char*)src;
+	unsigned int position = 0;
+	unsigned int current = 0;
+
+	while(current < size){
+		if(position >= packedSize){
+			return false;
+		}
+		unsigned int token = in[position++];
+
+		unsigned int literalLength = token >> 4;
+		if(literalLength == 15){
+			unsigned int more;
+			do{
+				if(position >= packedSize){
+					return false;
+				}
+				more = in[position++];
+				literalLength += more;
+			}while(more == 255);
+		}
+		if(position + literalLength > packedSize || current + literalLength > size){
+			return false;
+		}
+		memcpy(dst + current, in + position, literalLength);
+		position += literalLength;
+		current += literalLength;
+		if(current == size){
+			break;
+		}
+
+		if(position + 2 > packedSize){
+			return false;
+		}
+		unsigned int offset = in[position] | (in[position + 1] << 8);
+		position += 2;
+		unsigned int matchLength = (token & 15) + 4;
+		if((token & 15) == 15){
+			unsigned int more;
+			do{
+				if(position >= packedSize){
+					return false;
+				}
+				more = in[position++];
+				matchLength += more;
+			}while(more == 255);
+		}
+		if(offset == 0 || offset > current || current + matchLength > size){
+			return false;
+		}
+		//OVERLAPPING MATCHES REPEAT THE LAST offset BYTES, SO THE COPY GOES A BYTE AT A TIME
+		for(unsigned int k = 0; k < matchLength; k++){
+			dst[current + k] = dst[current - offset + k];
+		}
+		current += matchLength;
+	}
+	return true;
+}
+
+uint32_t crc32_for_byte(uint32_t r){
+	for(int j = 0; j < 8; j++){
+		r = (r & 1? 0: (uint32_t)0xEDB88320L) ^ r >> 1;
+	}
+	return r ^ (uint32_t)0xFF000000L;
+}
+
+uint32_t crc32(const void *data, size_t n_bytes){
+	uint32_t table[256];
+	uint32_t crc = 0;
+
+	for(uint32_t i = 0; i < 256; i++){
+		table[i] = crc32_for_byte(i);
+	}
+	for(uint32_t i = 0; i < n_bytes; i++){
+		crc = table[(uint8_t)crc ^ ((uint8_t*)data)[i]] ^ crc >> 8;
+	}
+	return crc;
+}
+
 //TODO: CHANGE FUNCTION INTERFACE FOR INPUT VECTORS
 std::atomic<bool> threadsReady[HMLIB_HANDLERS][2] = {false};
-void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& inputSizes, bool& pass){
+//INDEX OF THE FIRST INPUT OF EVERY REQUEST IN FLIGHT, BY THE PROGRAM COUNTER THE RECEIVER FINDS IN ITS OUTPUT META LINE
+std::unordered_map<unsigned int, unsigned int> firstInputs[HMLIB_HANDLERS];
+std::mutex firstInputsLock[HMLIB_HANDLERS];
+void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& inputSizes, bool& pass, const unsigned int arguments, const uint32_t argumentFlags){
 	pass = true;
 	unsigned int HMLibID = HMLibUH->HMLibID;
 
+	if(inputSizes.size() == 0){
+		std::string msg = "HMLib: " + std::to_string(HMLibID) + " --- No inputs for this thread\n";
+		HMLibObject.printForMe(msg);
+		return;
+	}
+
+	firstInputsLock[HMLibID].lock();
+	firstInputs[HMLibID].clear();
+	firstInputsLock[HMLibID].unlock();
+
 	threadsReady[HMLibID][0] = true;
 	while(!threadsReady[HMLibID][1]);
 
@@ -21,15 +221,17 @@ void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, co
 	HMLibObject.printForMe(msg);
 
 	unsigned int totalInputs = inputSizes.size();
+	unsigned int requests = 0;
 	for(unsigned int j = 0; j < totalInputs;){		
-		unsigned int batchedReq = 1;
+		unsigned int batchedReq = batchInputs(inputSizes, j, HMLibUH->inputSize);
 		unsigned int batched = 0;
 
 		std::chrono::steady_clock::time_point sendStart = std::chrono::steady_clock::now();
-	
-		if(batchedReq + j > totalInputs){
-			batchedReq = totalInputs - j;
-		}
+
+		//REGISTER BEFORE THE KERNEL CAN SEE THE REQUEST, commitInput TAGS IT WITH THE NEXT PROGRAM COUNTER
+		firstInputsLock[HMLibID].lock();
+		firstInputs[HMLibID][HMLibUH->programCounter + 1] = j;
+		firstInputsLock[HMLibID].unlock();
 
 		while(true){
 			uint64_t timeout;
@@ -40,7 +242,7 @@ void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, co
 			#endif
 			//TODO: CHANGE THE CODE 2 OR KEEP IT.
 			//THIS IS TO SIGNAL YOUR COMPUTE KERNEL WHAT TO DO
-			int ec = HMLibObject.sendInput((const char**)((const char*)(inputs.data()+j)), inputSizes.data()+j, batchedReq, batched, 2, timeout, HMLibUH);
+			int ec = HMLibObject.sendInput((const char**)(inputs.data()+j), inputSizes.data()+j, batchedReq, batched, 2, timeout, HMLibUH, HMLIB_PRIORITY_NORMAL, (requests % arguments) | argumentFlags, ((uint64_t)HMLibID << 56) | ((uint64_t)(requests & 0xFFFFFF) << 32));
 
 			if(ec >= 0){
 				#ifdef HW_SIM
@@ -69,7 +271,7 @@ void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, co
 						}
 						metaInspect += "\n";
 
-						char* inputPtr = HMLibUH->inputStart + (HMLibUH->bufferSections - (HMLibUH->metaEnd - metaPtr)/HMLibUH->metaSize) * HMLibUH->inputSize;
+						char* inputPtr = HMLibUH->inputStart + ((unsigned int*)metaPtr)[10] * HMLibUH->inputSize;
 						unsigned int position = 0;
 						for(unsigned int k = 0; k < 4; k++){
 							if(((unsigned int*)(metaPtr+2))[k] != 0){
@@ -103,6 +305,7 @@ void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, co
 			}
 		}
 		j += batched;
+		requests++;
 
 		std::chrono::steady_clock::time_point sendEnd = std::chrono::steady_clock::now();
 		std::chrono::duration<double> duration = sendEnd - sendStart;
@@ -115,7 +318,7 @@ void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, co
 }
 
 //TODO: CHANGE FUNCTION INTERFACE FOR OUTPUT VECTORS
-void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, std::vector<unsigned int>& answers, const unsigned int entries, const bool enableCheck, bool& pass){
+void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, std::vector<unsigned int>& answers, const unsigned int entries, const bool enableCheck, bool& pass, const bool anyOrder){
 
 	pass = true;
 	unsigned int HMLibID = HMLibUH->HMLibID;
@@ -130,12 +333,16 @@ void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH,
 	while(!threadsReady[HMLibID][0]);
 	threadsReady[HMLibID][1] = true;
 	
-	char* tmpCopy[MAX_BATCH_SIZE];
+	//RESULTS ARE READ IN PLACE FROM THE RING SLOT, NO COPY OUT
+	char* outPtr[MAX_BATCH_SIZE];
+	unsigned int outSizes[MAX_BATCH_SIZE] = {0};
 
-	for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
-		tmpCopy[i] = new char[HMLibUH->oneEntry+HMLibUH->metaSize];
+	//OUT OF ORDER, EVERY INPUT MUST COME BACK EXACTLY ONCE
+	std::vector<bool> received;
+	if(anyOrder){
+		answers.assign(entries, 0);
+		received.assign(entries, false);
 	}
-	unsigned int outSizes[MAX_BATCH_SIZE] = {0};
 
 	std::chrono::steady_clock::time_point totalStart = std::chrono::steady_clock::now();
 	while(true){
@@ -151,7 +358,12 @@ void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH,
 				timeout = (uint64_t)30*1000*1000*1000;
 			#endif
 
-			int ec = HMLibObject.checkOutput(tmpCopy, outSizes, batchProcessed, timeout, HMLibUH);
+			int ec;
+			if(anyOrder){
+				ec = HMLibObject.peekAnyOutput(outPtr, outSizes, batchProcessed, timeout, HMLibUH);
+			}else{
+				ec = HMLibObject.peekOutput(outPtr, outSizes, batchProcessed, timeout, HMLibUH);
+			}
 
 			if(ec == 0){
 				break;
@@ -172,15 +384,9 @@ void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH,
 				
 				HMLibObject.printForMe(msg);
 				pass = false;
-				for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
-					delete[] tmpCopy[i];
-				}
 				return;
 			}if(ec == -2){
 				pass = false;
-				for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
-					delete[] tmpCopy[i];
-				}
 				return;
 			}
 		}
@@ -188,25 +394,52 @@ void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH,
 		std::chrono::duration<double> duration = recvEnd - recvStart;
 		HMLibUH->oneReadTime += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
 
+		unsigned int first = processed;
+		if(anyOrder){
+			unsigned int programCounter = ((unsigned int*)HMLibUH->outputMeta)[15];
+			firstInputsLock[HMLibID].lock();
+			std::unordered_map<unsigned int, unsigned int>::iterator request = firstInputs[HMLibID].find(programCounter);
+			first = entries;
+			if(request != firstInputs[HMLibID].end()){
+				first = request->second;
+				firstInputs[HMLibID].erase(request);
+			}
+			firstInputsLock[HMLibID].unlock();
+
+			for(unsigned int i = 0; i < batchProcessed; i++){
+				if(first + i >= entries || received[first + i]){
+					std::string msg = "Thread Receiver: " + std::to_string(HMLibID) + " --- Unexpected output for input " + std::to_string(first + i) + ". Exiting\n";
+					HMLibObject.printForMe(msg);
+					pass = false;
+					return;
+				}
+				received[first + i] = true;
+			}
+		}
+
 		processed += batchProcessed;
 		if(enableCheck){
 			//TODO: MODIFY TO STORE YOUR OUTPUT INTO AN OUTPUT VECTOR
-			//YOU MUST KEEP THE HMLiubUH->metaSize OFFSET WHEN COPYING OUT
+			//outPtr[i] POINTS INTO THE RING SLOT AND IS ONLY VALID UNTIL releaseOutput
 			#ifdef HW_SIM
 			std::string msg = "Thread Receiver: " + std::to_string(HMLibID) + " --- Entries Processed: " + std::to_string(processed) + "/" + std::to_string(entries) + "\n";
 			HMLibObject.printForMe(msg);
 			#endif
 
 			for(unsigned int i = 0; i < batchProcessed; i++){
-				unsigned int crcAns;
-				if(i == 0){
-					memcpy(&crcAns,tmpCopy[i]+HMLibUH->metaSize, sizeof(unsigned int));
+				//THE ANSWER IS THE CRC OF THE WHOLE OUTPUT, THE HOST COMPARES IT WITH THE CRC OF ITS GOLDEN OUTPUT
+				unsigned int crcAns = crc32(outPtr[i], outSizes[i]);
+				if(anyOrder){
+					answers[first + i] = crcAns;
 				}else{
-					memcpy(&crcAns,tmpCopy[i], sizeof(unsigned int));
+					answers.push_back(crcAns);
 				}
-				answers.push_back(crcAns);
 			}
 		}
+		if(HMLibObject.releaseOutput(HMLibUH) != 0){
+			pass = false;
+			return;
+		}
 		if(processed == entries){
 			break;
 		}
@@ -220,7 +453,4 @@ void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH,
 	HMLibObject.printForMe(msg);
 
 	threadsReady[HMLibID][1] = false;
-	for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
-		delete[] tmpCopy[i];
-	}
 }
@@ -14,8 +14,61 @@
 #include <pthread.h>
 #include <math.h>
 
-#define HMLIB_HANDLERS 1
+//NUMBER OF HANDLERS BUILT INTO THE XCLBIN. MUST MATCH HM_HANDLERS IN hmlib_top.h
+//initialize() CAN ENABLE ANY NUMBER OF THEM FROM 1 TO HMLIB_HANDLERS
+#ifndef HMLIB_HANDLERS
+#define HMLIB_HANDLERS 2
+#endif
+//USER PEs BEHIND EACH HANDLER. MUST MATCH HM_PE_PER_HANDLER IN hmlib_top.h
+#ifndef HMLIB_PE_PER_HANDLER
+#define HMLIB_PE_PER_HANDLER 1
+#endif
+#define HMLIB_USER_PES (HMLIB_HANDLERS*HMLIB_PE_PER_HANDLER)
+//RING GEOMETRY THE KERNEL WAS BUILT FOR (SECTIONS, SLOT BYTES), MUST MATCH HM_FIXED_* IN hmlib_top.h.
+//0 WHEN THE KERNEL TAKES IT AT RUN TIME. OTHERWISE THE RINGS MUST BE SIZED EXACTLY LIKE THIS
+#ifndef HMLIB_FIXED_SECTIONS
+#define HMLIB_FIXED_SECTIONS 0
+#endif
+#ifndef HMLIB_FIXED_INPUT_SIZE
+#define HMLIB_FIXED_INPUT_SIZE 0
+#endif
+#ifndef HMLIB_FIXED_OUTPUT_SIZE
+#define HMLIB_FIXED_OUTPUT_SIZE 0
+#endif
 #define BUS_WIDTH_BYTES 64
+//REQUESTS UP TO THIS SIZE (BYTES) ARE BATCHED MAX_BATCH_SIZE PER RING SLOT
+#define BATCH_SLOT_LIMIT 4096
+//META LINES THE KERNEL READS PER POLL. MUST MATCH BURST_LENGTH IN hmlib_top.h, RINGS ARE ROUNDED UP TO A MULTIPLE OF IT
+#define META_BURST_LINES 8
+//THE DOORBELL BURST SITS BETWEEN THE META SECTIONS AND THE INPUT SLOTS, SO ITS OFFSET DOES NOT DEPEND ON THE SLOT SIZES
+//(HANDLERS LEFT IDLE BY initialize() HAVE SMALLER SLOTS THAN THE GEOMETRY THE KERNEL WAS STARTED WITH)
+#define HMLIB_DOORBELL_BYTES (META_BURST_LINES*BUS_WIDTH_BYTES)
+//META SECTIONS OF A SECOND, HIGH PRIORITY RING BETWEEN THE DOORBELL BURST AND THE INPUT SLOTS (A MULTIPLE OF 8, 0 FOR NONE).
+//THE KERNEL FETCHES ITS META LINES FIRST. MUST MATCH HM_PRIORITY_SECTIONS IN hmlib_top.h
+#ifndef HMLIB_PRIORITY_SECTIONS
+#define HMLIB_PRIORITY_SECTIONS 0
+#endif
+#if HMLIB_PRIORITY_SECTIONS % META_BURST_LINES != 0
+#error "HMLIB_PRIORITY_SECTIONS must be a multiple of 8"
+#endif
+//HIGH PRIORITY PROGRAM COUNTERS COUNT UP FROM HERE SO THEY NEVER MATCH A NORMAL ONE. MUST MATCH PRIORITY_PC IN hmlib_top.h
+#define HMLIB_PRIORITY_PC 0x80000000u
+//FROM THE END OF THE META SECTIONS TO THE FIRST INPUT SLOT
+#define HMLIB_SLOT_OFFSET_BYTES (HMLIB_DOORBELL_BYTES + HMLIB_PRIORITY_SECTIONS*BUS_WIDTH_BYTES)
+//1: commitInput SENDS THE INPUTS OF A REQUEST AS ONE LZ4 BLOCK WHEN THAT SAVES AT LEAST A LINE. MUST MATCH HM_COMPRESS IN hmlib_top.h
+#ifndef HMLIB_COMPRESS
+#define HMLIB_COMPRESS 0
+#endif
+//HISTORY THE KERNEL KEEPS TO EXPAND A BLOCK (BYTES), MATCHES NEVER REACH FURTHER BACK. MUST MATCH HM_COMPRESS_WINDOW
+#ifndef HMLIB_COMPRESS_WINDOW
+#define HMLIB_COMPRESS_WINDOW 4096
+#endif
+//THE PACKED LINE COUNT TRAVELS IN BITS 48-63 OF THE META LINE, LARGER REQUESTS ARE SENT AS IS
+#define HMLIB_COMPRESS_MAX_LINES 65535
+//1: sendInputGather PASSES INPUTS IN REGISTERED BUFFERS BY REFERENCE, THE KERNEL READS THEM IN PLACE. MUST MATCH HM_GATHER IN hmlib_top.h
+#ifndef HMLIB_GATHER
+#define HMLIB_GATHER 0
+#endif
 
 
 #define stevez_debug 0
@@ -26,10 +79,19 @@
 struct HMLibUniqueHandler;
 class HMLib;
 
-void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& sizes, bool& pass);
-void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, std::vector<unsigned int>& answers, const unsigned int entries, const bool enableCheck, bool& pass);
+//SUCCESSIVE REQUESTS CARRY THE ARGUMENTS 0 TO arguments-1 IN TURN, OR'D WITH argumentFlags (commitInput). THE OPERAND
+//HOLDS THE HANDLER ID IN BITS 56-63 AND THE REQUEST NUMBER IN BITS 32-55, SO NO TWO REQUESTS OF A RUN SHARE IT
+void parallelTaskSend(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, const std::vector<char*>& inputs, const std::vector<unsigned int>& sizes, bool& pass, const unsigned int arguments = 1, const uint32_t argumentFlags = 0);
+//anyOrder RETIRES REQUESTS AS THEY FINISH (peekAnyOutput) AND PUTS EACH ANSWER AT THE INDEX OF ITS INPUT, WHICH parallelTaskSend
+//REGISTERS UNDER THE PROGRAM COUNTER OF THE REQUEST
+void parallelTaskReceive(HMLib& HMLibObject, struct HMLibUniqueHandler* HMLibUH, std::vector<unsigned int>& answers, const unsigned int entries, const bool enableCheck, bool& pass, const bool anyOrder = false);
 
+uint32_t crc32(const void *data, size_t n_bytes);
 unsigned int customRound(unsigned int valueToRound, unsigned int round);
+unsigned int batchInputs(const std::vector<unsigned int>& inputSizes, const unsigned int first, const unsigned int slotSize);
+unsigned int batchSlotSize(const unsigned int requestSize, const unsigned int entrySize);
+unsigned int lz4Compress(const char* src, const unsigned int size, char* dst, const unsigned int capacity);
+bool lz4Decompress(const char* src, const unsigned int packedSize, char* dst, const unsigned int size);
 
 #include <string>
     // Constant array of input sizes in bytes
@@ -77,6 +77,7 @@ void krnl_histogram_equalization(hls::stream<ap_uint<512>>& hostMemStrmToUserBuf
 	unsigned int size = 0;	
 	unsigned int outputSize = BINS_NUM; 
 	double inputLength = sizes[countNum];
+	//EACH BATCHED INPUT GETS ITS OWN HISTOGRAM, CLOSED BY A SIZE PACKET WITH BIT-512 SET
 
 	//TODO: MODIFY YOUR CORE KERNEL TO HANDLE 512 BIT INPUT
 	COMPUTE: for(int i = 0; i < iterations; i++){
@@ -93,7 +94,10 @@ void krnl_histogram_equalization(hls::stream<ap_uint<512>>& hostMemStrmToUserBuf
 			// reformat the input data to 64 bytes for blowfish
 			ptr_plainText[j] = get1.range(8*j+7,8*j);
             assert(ptr_plainText[j] < BINS_NUM && ptr_plainText[j] >= 0); 
-            freq_plainText[ptr_plainText[j]] += 1;
+			// the padding after the last byte of an input is not part of its histogram
+			if(size + j < sizes[countNum]){
+				freq_plainText[ptr_plainText[j]] += 1;
+			}
         }
 	
 		if (VERBOSE && DEBUG){
@@ -107,6 +111,7 @@ void krnl_histogram_equalization(hls::stream<ap_uint<512>>& hostMemStrmToUserBuf
 		size += 64;
 		if(size >= sizes[countNum]){
 			
+			inputLength = sizes[countNum];
 			countNum++;
 			size = 0;
 
@@ -191,6 +196,14 @@ void krnl_histogram_equalization(hls::stream<ap_uint<512>>& hostMemStrmToUserBuf
 				hostMemStrmFromUser.write(sendPkt);
 			}
 
+			// start the next batched input from an empty histogram
+			for(uint32_t i = 0; i < BINS_NUM; i++){
+				#pragma HLS PIPELINE II=1
+				freq_plainText[i] = 0;
+				acc_hist[i] = 0;
+				round[i] = 0;
+			}
+
 		}
 		
 	}
@@ -199,7 +212,7 @@ void krnl_histogram_equalization(hls::stream<ap_uint<512>>& hostMemStrmToUserBuf
 
 
 void functionControl(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, 
-	bool state[2], unsigned int sizes[4], unsigned int& iterations, unsigned int batchCount){
+	bool state[2], unsigned int sizes[4], unsigned int& iterations, unsigned int& batchCount){
 	#pragma HLS inline off
 
 	ap_uint<512> getPkt = hostMemStrmToUserBuffer.read();
@@ -222,15 +235,17 @@ void functionControl(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::st
 		hostMemStrmFromUser.write(sendPkt);
 	}else if(code.range(31,0) == 2){
 		//TODO: CODE 2 MATCHES WITH HELPER.CPP
+		//GET THE NUMBER OF BATCHED INPUTS FROM BIT RANGE 32-63
 		//GET THE NUMBER OF ITERATION IN TERMS OF 64 BYTES FROM BIT RANGE 64-95
-		//batchCount = code.range(63,32);
+		batchCount = code.range(63,32);
 		iterations = code.range(95,64);
 		
-		//TODO: GET THE ORIGINAL INPUT SIZE FROM BIT 96-127
+		//TODO: GET THE ORIGINAL INPUT SIZES FROM BIT 96-223, UNUSED ENTRIES ARE 0
+		//EVERY BATCHED INPUT STARTS ON A NEW 64 BYTE LINE
 		sizes[0] = code.range(127,96);
-		/*sizes[1] = code.range(159,128);
+		sizes[1] = code.range(159,128);
 		sizes[2] = code.range(191,160);
-		sizes[3] = code.range(223,192);*/
+		sizes[3] = code.range(223,192);
 
 		//TODO: ACKNOWLEDGE THE CODE
 		state[1] = true;
@@ -284,6 +299,13 @@ void bufferData(hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser, hls::stream
 	}
 }
 
+#ifdef HMLIB_SOFTWARE
+//ENTRY FOR THE HMLib SOFTWARE BACKEND (hmlib_sw.h), WHICH FEEDS THE PE DIRECTLY IN PLACE OF bufferData
+void histogram_SW(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal){
+	histogramPE<0>(hostMemStrmToUserBuffer, hostMemStrmFromUser, stopSignal);
+}
+#endif
+
 extern "C" {
 
 void histogram_HM(hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser1, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser1) {
@@ -1,30 +1,614 @@
 
 #include "hmlib.h"
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+
+//TSC TICKS PER NANOSECOND, MEASURED ONCE AGAINST steady_clock. ASSUMES AN INVARIANT TSC
+static double tscTicksPerNS(){
+	static const double ticksPerNS = [](){
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		uint64_t c1 = __rdtsc();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		uint64_t c2 = __rdtsc();
+		std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1).count();
+		return (double)(c2 - c1)/(double)ns;
+	}();
+	return ticksPerNS;
+}
+
+//ONE WAIT FOR A FREE SLOT OR A RESULT. THE DEADLINE IS KEPT IN TSC TICKS SO A POLL COSTS AN rdtsc INSTEAD OF A CLOCK CALL
+struct HMLibWaiter{
+	HMLibWaitPolicy policy;
+	double ticksPerNS;
+	uint64_t start;
+	uint64_t deadline;
+	uint64_t spinUntil;
+	uint64_t parkNS;
+
+	HMLibWaiter(const HMLibWaitPolicy waitPolicy, const uint64_t timeoutNS){
+		policy = waitPolicy;
+		ticksPerNS = tscTicksPerNS();
+		start = __rdtsc();
+		deadline = (timeoutNS != 0) ? start + (uint64_t)(timeoutNS * ticksPerNS) : 0;
+		spinUntil = start + (uint64_t)(HMLIB_SPIN_NS * ticksPerNS);
+		parkNS = HMLIB_PARK_MIN_NS;
+	}
+
+	//BACK OFF ONCE. RETURNS FALSE WHEN THE DEADLINE HAS PASSED
+	//A PARKED THREAD SLEEPS ON wakeWord WHILE IT STILL HOLDS parkedValue, OR JUST SLEEPS IF THERE IS NO wakeWord
+	bool pause(std::atomic<unsigned int>* wakeWord, const unsigned int parkedValue){
+		uint64_t now = __rdtsc();
+		if(deadline != 0 && now >= deadline){
+			return false;
+		}
+		if(policy == HMLIB_WAIT_SPIN || now < spinUntil){
+			_mm_pause();
+			return true;
+		}
+		if(policy == HMLIB_WAIT_SPIN_YIELD){
+			std::this_thread::yield();
+			return true;
+		}
+
+		uint64_t parkFor = parkNS;
+		if(deadline != 0){
+			parkFor = std::min(parkFor, (uint64_t)((deadline - now)/ticksPerNS) + 1);
+		}
+		if(wakeWord != nullptr){
+			struct timespec ts;
+			ts.tv_sec = parkFor/1000000000;
+			ts.tv_nsec = parkFor%1000000000;
+			syscall(SYS_futex, (int*)wakeWord, FUTEX_WAIT_PRIVATE, parkedValue, &ts, nullptr, 0);
+		}else{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(parkFor));
+		}
+		parkNS = std::min(parkNS * 2, (uint64_t)HMLIB_PARK_MAX_NS);
+		return true;
+	}
+
+	uint64_t elapsedNS(){
+		return (uint64_t)((__rdtsc() - start)/ticksPerNS);
+	}
+};
+
+//BITMAPS OVER THE DATA SLOTS AND META SECTIONS OF ONE RING. ONLY THE SENDER SETS BITS AND ONLY THE RECEIVER CLEARS
+//THEM, SO A RUN THE SENDER SEES FREE STAYS FREE UNTIL IT CLAIMS IT
+static bool testBit(std::atomic<uint64_t>* bits, const unsigned int k){
+	return (bits[k/64].load(std::memory_order_acquire) >> (k%64)) & 1;
+}
+
+static void setBits(std::atomic<uint64_t>* bits, const unsigned int first, const unsigned int count, const bool value){
+	for(unsigned int k = first; k < first + count; k++){
+		uint64_t mask = (uint64_t)1 << (k%64);
+		if(value){
+			bits[k/64].fetch_or(mask, std::memory_order_release);
+		}else{
+			bits[k/64].fetch_and(~mask, std::memory_order_release);
+		}
+	}
+}
+
+//NEXT FIT: THE FIRST RUN OF span FREE SLOTS FROM THE SLOT AFTER THE LAST REQUEST, THEN FROM SLOT 0. A RUN NEVER WRAPS,
+//SO THE KERNEL STILL READS AND WRITES ONE REQUEST AS ONE CONTIGUOUS RANGE
+static bool findFreeSlots(struct HMLibUniqueHandler* hmo, const unsigned int span, unsigned int& slot){
+	unsigned int hint = (hmo->inputPtr - hmo->inputStart)/hmo->inputSize;
+	for(unsigned int pass = 0; pass < 2; pass++){
+		unsigned int from = (pass == 0) ? hint : 0;
+		unsigned int to = (pass == 0) ? hmo->bufferSections : std::min(hint + span - 1, hmo->bufferSections);
+		unsigned int run = 0;
+		for(unsigned int k = from; k < to; k++){
+			if(testBit(hmo->slotBits, k)){
+				run = 0;
+			}else if(++run == span){
+				slot = k + 1 - span;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+//SECTIONS 0..bufferSections-1 ARE THE NORMAL META LINES, THE HIGH PRIORITY ONES FOLLOW
+static char* metaOfSection(struct HMLibUniqueHandler* hmo, const unsigned int section){
+	if(section < hmo->bufferSections){
+		return hmo->metaStart + section * hmo->metaSize;
+	}
+	return hmo->priorityStart + (section - hmo->bufferSections) * hmo->metaSize;
+}
+
+static unsigned int sectionOfMeta(struct HMLibUniqueHandler* hmo, const char* line){
+	if(line < hmo->metaEnd){
+		return (line - hmo->metaStart)/hmo->metaSize;
+	}
+	return hmo->bufferSections + (line - hmo->priorityStart)/hmo->metaSize;
+}
+
+//THE FIRST SECTION IN FLIGHT THE KERNEL HAS MARKED DONE. HIGH PRIORITY SECTIONS FIRST, THEN THE NORMAL ONES STARTING
+//FROM THE OLDEST AND GOING ROUND THE RING ONCE
+static char* findDoneSection(struct HMLibUniqueHandler* hmo){
+	for(unsigned int k = hmo->bufferSections; k < hmo->bufferSections + HMLIB_PRIORITY_SECTIONS; k++){
+		if(testBit(hmo->inFlightBits, k) && ((volatile unsigned int*)metaOfSection(hmo, k))[13] == 2){
+			return metaOfSection(hmo, k);
+		}
+	}
+	unsigned int words = (hmo->bufferSections + 63)/64;
+	unsigned int oldest = (hmo->outputMetaPtr - hmo->metaStart)/hmo->metaSize;
+	for(unsigned int n = 0; n <= words; n++){
+		unsigned int w = (oldest/64 + n) % words;
+		uint64_t bits = hmo->inFlightBits[w].load(std::memory_order_acquire);
+		if(n == 0){
+			bits &= ~(uint64_t)0 << (oldest%64);
+		}else if(n == words){
+			bits &= ((uint64_t)1 << (oldest%64)) - 1;
+		}
+		if(w == words - 1 && hmo->bufferSections % 64 != 0){
+			bits &= ((uint64_t)1 << (hmo->bufferSections%64)) - 1;
+		}
+		while(bits != 0){
+			char* line = hmo->metaStart + (w*64 + __builtin_ctzll(bits)) * hmo->metaSize;
+			if(((volatile unsigned int*)line)[13] == 2){
+				return line;
+			}
+			bits &= bits - 1;
+		}
+	}
+	return nullptr;
+}
+
+//RING COPY ENGINES. THE KERNEL READS THE RING OVER PCIE, SO NON-TEMPORAL STORES KEEP THE PAYLOAD OUT OF THE LLC.
+//DESTINATIONS ARE ALWAYS 64 BYTE ALIGNED (SLOTS AND BATCHED INPUTS START ON A LINE) AND A PARTIAL
+//LAST LINE IS ZERO PADDED SO EVERY STORE COVERS A FULL LINE
+__attribute__((target("avx512f")))
+static void streamCopyAVX512(char* dst, const char* src, const unsigned int size){
+	unsigned int lines = size/64;
+	for(unsigned int i = 0; i < lines; i++){
+		__m512i val = _mm512_loadu_si512((const void*)(src+64*i));
+		_mm512_stream_si512((__m512i*)(dst+64*i),val);
+	}
+	if(size%64 != 0){
+		alignas(64) char last[64] = {0};
+		memcpy(last,src+64*lines,size%64);
+		_mm512_stream_si512((__m512i*)(dst+64*lines),_mm512_load_si512((const void*)last));
+	}
+}
+
+__attribute__((target("avx2")))
+static void streamCopyAVX2(char* dst, const char* src, const unsigned int size){
+	unsigned int lines = size/64;
+	for(unsigned int i = 0; i < lines; i++){
+		__m256i low = _mm256_loadu_si256((const __m256i*)(src+64*i));
+		__m256i high = _mm256_loadu_si256((const __m256i*)(src+64*i+32));
+		_mm256_stream_si256((__m256i*)(dst+64*i),low);
+		_mm256_stream_si256((__m256i*)(dst+64*i+32),high);
+	}
+	if(size%64 != 0){
+		alignas(64) char last[64] = {0};
+		memcpy(last,src+64*lines,size%64);
+		_mm256_stream_si256((__m256i*)(dst+64*lines),_mm256_load_si256((const __m256i*)last));
+		_mm256_stream_si256((__m256i*)(dst+64*lines+32),_mm256_load_si256((const __m256i*)(last+32)));
+	}
+}
 
 HMLib::HMLib(){
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		hmStatesTracker[i] = false;
+		HMLibMappedMem[i] = nullptr;
+		ringCapacity[i] = 0;
+		ringDeviceAddress[i] = 0;
 	}
 
 	didInitialize = false;
+	kernelRunning = false;
+	activeHandlers = 0;
+
+	waitPolicy = (HMLibWaitPolicy)HMLIB_WAIT_POLICY;
+	asyncRunning = false;
+	asyncNext = 0;
+	reactorRunning = false;
+	softwareDevice = nullptr;
+
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		copyEngine = HMLIB_COPY_AVX512;
+	}else if(__builtin_cpu_supports("avx2")){
+		copyEngine = HMLIB_COPY_AVX2;
+	}else{
+		copyEngine = HMLIB_COPY_MEMCPY;
+	}
+}
+
+void HMLib::copyToRing(char* dst, const char* src, const unsigned int size){
+	if(copyEngine == HMLIB_COPY_AVX512){
+		streamCopyAVX512(dst,src,size);
+	}else if(copyEngine == HMLIB_COPY_AVX2){
+		streamCopyAVX2(dst,src,size);
+	}else{
+		memcpy(dst,src,size);
+	}
+}
+
+void HMLib::publishMeta(char* dst, const char* line){
+	if(copyEngine != HMLIB_COPY_MEMCPY){
+		//STREAMED PAYLOAD MUST BE GLOBALLY VISIBLE BEFORE THE KERNEL CAN SEE THE META LINE,
+		//THE SECOND FENCE DRAINS THE META LINE ITSELF OUT OF THE WRITE COMBINING BUFFER
+		_mm_sfence();
+		copyToRing(dst,line,64);
+		_mm_sfence();
+	}else{
+		//THE KERNEL ACCEPTS A META LINE WHEN ITS SEND PC (BITS 448-479) CHANGES, SO THAT IS WRITTEN LAST
+		memcpy(dst,line,56);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(dst+56,line+56,8);
+	}
+}
+
+//TELLS THE KERNEL HOW FAR THE META LINES GO. CALLED AFTER THE META LINE IS PUBLISHED SO A KERNEL THAT SEES
+//THE NEW PROGRAM COUNTER ALSO SEES THE LINE. WITH HM_DOORBELL=0 THE KERNEL NEVER READS IT
+void HMLib::ringDoorbell(struct HMLibUniqueHandler* hmo){
+	std::atomic_thread_fence(std::memory_order_release);
+	((volatile unsigned int*)hmo->doorbell)[0] = hmo->programCounter;
+	((volatile unsigned int*)hmo->doorbell)[1] = hmo->priorityProgramCounter;
+}
+
+HMLibWaitPolicy HMLib::getWaitPolicy(){
+	return waitPolicy;
+}
+
+void HMLib::setWaitPolicy(const HMLibWaitPolicy policy){
+	waitPolicy = policy;
+}
+
+HMLibCopyEngine HMLib::getCopyEngine(){
+	return copyEngine;
+}
+
+bool HMLib::setCopyEngine(const HMLibCopyEngine engine){
+	if((engine == HMLIB_COPY_AVX512 && !__builtin_cpu_supports("avx512f")) || (engine == HMLIB_COPY_AVX2 && !__builtin_cpu_supports("avx2"))){
+		std::cerr << "Copy engine " << engine << " not supported by this CPU" << "\n";
+		return false;
+	}
+	copyEngine = engine;
+	return true;
 }
 
 HMLib::~HMLib(){
 	if(didInitialize){
-		stopKernel();
+		if(asyncRunning){
+			stopAsync();
+		}
+		if(reactorRunning){
+			stopReactor();
+		}
+		if(kernelRunning){
+			stopKernel();
+		}
+		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+			releaseRing(i);
+		}
+		while(!registeredBuffers.empty()){
+			unregisterBuffer(registeredBuffers.back().host);
+		}
+		if(softwareDevice != nullptr){
+			softwareDevice->finish();
+			for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+				free(HMLibMappedMem[i]);
+			}
+			std::cout << "Cleanup complete for " << softwareDevice->name() << "\n";
+			return;
+		}
+		#ifndef HMLIB_SOFTWARE
 		q.finish();
 		std::cout << "Cleanup complete for 1st kernel" << "\n";
 		q.finish();
 		std::cout << "Cleanup complete for 2nd kernel" << "\n";
+		#endif
+	}
+}
+
+void HMLib::sizeRings(const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers){
+	//Handlers past the requested count are still wired in the xclbin. They get a minimal ring
+	//that only ever carries the exit code so the kernel can shut them down.
+	activeHandlers = handlers;
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		hostMemStates[i].metaSize = 64 * sizeof(char);
+		if(i < activeHandlers){
+			//THE KERNEL ADDRESSES SECTIONS IN 64 BYTE LINES
+			hostMemStates[i].inputSize = customRound(inputSize,BUS_WIDTH_BYTES);
+			hostMemStates[i].outSize = customRound(outputSize,BUS_WIDTH_BYTES)/* + hostMemStates[i].metaSize*/;
+		}else{
+			hostMemStates[i].inputSize = BUS_WIDTH_BYTES;
+			hostMemStates[i].outSize = BUS_WIDTH_BYTES;
+		}
+		hostMemStates[i].oneEntry = hostMemStates[i].inputSize + hostMemStates[i].metaSize + hostMemStates[i].outSize;
+		//THE KERNEL POLLS META LINES IN BURSTS, A BURST NEVER RUNS PAST THE META SECTIONS
+		hostMemStates[i].bufferSections = customRound(bufferSections,META_BURST_LINES);
 	}
 }
 
-bool HMLib::initialize(const std::string binaryFile, const std::string kernelName, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize){
+void HMLib::setupRing(const unsigned int i){
+	hostMemStates[i].HMLibID = i;
+	hostMemStates[i].metaStart = HMLibMappedMem[i];
+	hostMemStates[i].metaEnd = HMLibMappedMem[i] + hostMemStates[i].bufferSections * hostMemStates[i].metaSize;
+	hostMemStates[i].doorbell = hostMemStates[i].metaEnd;
+	hostMemStates[i].priorityStart = hostMemStates[i].metaEnd + HMLIB_DOORBELL_BYTES;
+	hostMemStates[i].priorityEnd = hostMemStates[i].priorityStart + HMLIB_PRIORITY_SECTIONS * hostMemStates[i].metaSize;
+	hostMemStates[i].inputStart = hostMemStates[i].metaEnd + HMLIB_SLOT_OFFSET_BYTES;
+	hostMemStates[i].inputEnd = hostMemStates[i].inputStart + hostMemStates[i].inputSize * hostMemStates[i].bufferSections;
+	hostMemStates[i].outputStart = hostMemStates[i].inputEnd;
+
+	hostMemStates[i].outputEnd = hostMemStates[i].outputStart + hostMemStates[i].outSize * hostMemStates[i].bufferSections;
+
+	hostMemStates[i].inputMetaPtr = hostMemStates[i].metaStart;
+	hostMemStates[i].inputPtr = hostMemStates[i].inputStart;
+	hostMemStates[i].programCounter = 0;
+	hostMemStates[i].priorityMetaPtr = hostMemStates[i].priorityStart;
+	hostMemStates[i].priorityProgramCounter = HMLIB_PRIORITY_PC;
+	hostMemStates[i].reservePriority = HMLIB_PRIORITY_NORMAL;
+	hostMemStates[i].reserveDescriptors = 0;
+	hostMemStates[i].totalSize = 0;
+	hostMemStates[i].timeWaitSend = 0;
+	hostMemStates[i].copyTimeIn = 0;
+	hostMemStates[i].oneSendTime = 0;
+	hostMemStates[i].packedSize = 0;
+	hostMemStates[i].unpackedSize = 0;
+	
+	hostMemStates[i].outputMetaPtr = hostMemStates[i].metaStart;
+	hostMemStates[i].outputPtr = hostMemStates[i].outputStart;
+	hostMemStates[i].outputProgramCounter = 1;
+	hostMemStates[i].copyTimeOut = 0;
+	hostMemStates[i].latencies = 0;
+	hostMemStates[i].prefetchHelp = 0;
+	hostMemStates[i].computeLatency = 0;
+	hostMemStates[i].threadProcessed = 0;
+
+	hostMemStates[i].oneReadTime = 0;
+	hostMemStates[i].overallTime = 0;
+	hostMemStates[i].timeWaitRead = 0;
+	hostMemStates[i].reserveStart = 0;
+	hostMemStates[i].peekStart = 0;
+	hostMemStates[i].inputReserved = false;
+	hostMemStates[i].outputPeeked = false;
+
+	hostMemStates[i].reserveSpan = 0;
+	hostMemStates[i].reserveSlot = 0;
+	hostMemStates[i].peekSection = 0;
+
+	hostMemStates[i].full = new std::atomic<unsigned int>();
+	*(hostMemStates[i].full) = 0;
+	hostMemStates[i].sendNeed = new std::atomic<unsigned int>();
+	*(hostMemStates[i].sendNeed) = 0;
+	hostMemStates[i].spans = new struct HMLibSpan[hostMemStates[i].bufferSections + HMLIB_PRIORITY_SECTIONS]();
+	unsigned int words = (hostMemStates[i].bufferSections + HMLIB_PRIORITY_SECTIONS + 63)/64;
+	hostMemStates[i].slotBits = new std::atomic<uint64_t>[words];
+	hostMemStates[i].inFlightBits = new std::atomic<uint64_t>[words];
+	for(unsigned int k = 0; k < words; k++){
+		hostMemStates[i].slotBits[k] = 0;
+		hostMemStates[i].inFlightBits[k] = 0;
+	}
+	hostMemStates[i].packBuffer = nullptr;
+	#if HMLIB_COMPRESS
+		hostMemStates[i].packBuffer = new char[std::min((size_t)hostMemStates[i].inputSize * hostMemStates[i].bufferSections, (size_t)HMLIB_COMPRESS_MAX_LINES * 64)];
+	#endif
+
+	memset(HMLibMappedMem[i], 0, hostMemStates[i].oneEntry * hostMemStates[i].bufferSections + HMLIB_SLOT_OFFSET_BYTES);
+	((unsigned int*)hostMemStates[i].doorbell)[1] = HMLIB_PRIORITY_PC;
+
+	std::cout << "INSPECT HANDLER META BUFFER INITIALIZE: " << i << " " << (void*)HMLibMappedMem[i] << "\n";
+	for(unsigned int k = 0; k < hostMemStates[i].bufferSections; k++){
+		std::cout << "META BUFFER SECTION: " << k << "\n";
+		for(unsigned int l = 0; l < hostMemStates[i].metaSize; l++){
+			std::cout << (int)*(HMLibMappedMem[i] + hostMemStates[i].metaSize*k + l) << " " << " ";
+		}
+		std::cout << "\n";
+	}
+}
+
+void HMLib::releaseRing(const unsigned int i){
+	delete hostMemStates[i].full;
+	delete hostMemStates[i].sendNeed;
+	delete[] hostMemStates[i].spans;
+	delete[] hostMemStates[i].slotBits;
+	delete[] hostMemStates[i].inFlightBits;
+	delete[] hostMemStates[i].packBuffer;
+	hostMemStates[i].full = nullptr;
+	hostMemStates[i].sendNeed = nullptr;
+	hostMemStates[i].spans = nullptr;
+	hostMemStates[i].slotBits = nullptr;
+	hostMemStates[i].inFlightBits = nullptr;
+	hostMemStates[i].packBuffer = nullptr;
+}
+
+//A RING THAT STILL FITS IN ITS ALLOCATION IS RE-CARVED IN PLACE, THE DEVICE BUFFER IS ONLY REPLACED WHEN IT GROWS
+bool HMLib::mapRing(const unsigned int i){
+	size_t ringSize = customRound(hostMemStates[i].oneEntry * hostMemStates[i].bufferSections + HMLIB_SLOT_OFFSET_BYTES, 4096);
+	if(ringSize <= ringCapacity[i]){
+		return true;
+	}
+
+	if(softwareDevice != nullptr){
+		free(HMLibMappedMem[i]);
+		HMLibMappedMem[i] = (char*)aligned_alloc(4096, ringSize);
+		if(HMLibMappedMem[i] == nullptr){
+			std::cerr << "Could not allocate ring for handler: " << i << "\n";
+			return false;
+		}
+		ringCapacity[i] = ringSize;
+		ringDeviceAddress[i] = (uint64_t)HMLibMappedMem[i];
+		return true;
+	}
+
+	#ifdef HMLIB_SOFTWARE
+	return false;
+	#else
+	cl_int err = 0;
+	if(HMLibMappedMem[i] != nullptr){
+		q.enqueueUnmapMemObject(HMLibKernelMemory[i], HMLibMappedMem[i]);
+		HMLibMappedMem[i] = nullptr;
+	}
+
+	//Enable memory for large NDT table space for NDT Lookup
+	cl_mem_ext_ptr_t hostBufferExt;
+	hostBufferExt.flags = XCL_MEM_EXT_HOST_ONLY;
+	hostBufferExt.obj = nullptr;
+	hostBufferExt.param = 0;
+
+	HMLibKernelMemory[i] = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, ringSize, &hostBufferExt, &err);
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not allocate buffer for HMLibKernelMemory, error number: " << err << "\n";
+		return false;
+	}
+
+	//Map to host for setting values
+	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+	HMLibMappedMem[i] = (char*)q.enqueueMapBuffer(HMLibKernelMemory[i], CL_TRUE, CL_MAP_WRITE, 0, ringSize, nullptr, nullptr, &err);
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not map HMLibMappedMem, error number: " << err << "\n";
+		return false;
+	}
+
+	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+	std::chrono::duration<double> duration = t2 - t1;
+	std::cout << "MAP TIME NS: " <<  std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() << "\n";
+
+	err = xclGetMemObjDeviceAddress(HMLibKernelMemory[i].get(), device.get(), sizeof(uint64_t), &ringDeviceAddress[i]);
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not get the device address of HMLibKernelMemory, error number: " << err << "\n";
+		return false;
+	}
+
+	ringCapacity[i] = ringSize;
+	return true;
+	#endif
+}
+
+bool HMLib::startKernel(){
+	if(softwareDevice != nullptr){
+		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+			if(!softwareDevice->start(i, HMLibMappedMem[i], hostMemStates[i].bufferSections, hostMemStates[i].inputSize, hostMemStates[i].outSize)){
+				std::cerr << "Could not start " << softwareDevice->name() << " for handler: " << i << "\n";
+				return false;
+			}
+		}
+		kernelRunning = true;
+		return true;
+	}
+
+	#ifdef HMLIB_SOFTWARE
+	return false;
+	#else
+	#if HMLIB_FIXED_SECTIONS
+		if(hostMemStates[0].bufferSections != HMLIB_FIXED_SECTIONS || hostMemStates[0].inputSize != HMLIB_FIXED_INPUT_SIZE || hostMemStates[0].outSize != HMLIB_FIXED_OUTPUT_SIZE){
+			std::cerr << "HMLib kernel is built for " << HMLIB_FIXED_SECTIONS << " sections of " << HMLIB_FIXED_INPUT_SIZE << "/" << HMLIB_FIXED_OUTPUT_SIZE
+				<< " bytes, got " << hostMemStates[0].bufferSections << " of " << hostMemStates[0].inputSize << "/" << hostMemStates[0].outSize << "\n";
+			return false;
+		}
+	#endif
+
+	//Enqueue kernel to start HMLib kernel
+	cl_int err = 0;
+	int argN = 0;
+	err = HMLibKernel.setArg(argN, (unsigned int)hostMemStates[0].bufferSections);
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
+		return false;
+	}
+	argN++;
+
+	err = HMLibKernel.setArg(argN, (unsigned int)(hostMemStates[0].inputSize/BUS_WIDTH_BYTES));
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
+		return false;
+	}
+	argN++;
+
+	err = HMLibKernel.setArg(argN, (unsigned int)(hostMemStates[0].outSize/BUS_WIDTH_BYTES));
+	if(err != CL_SUCCESS){
+		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
+		return false;
+	}
+	argN++;
+	
+	//EVERY RING IS BOUND TWICE, ONCE FOR THE DATA MASTER AND ONCE FOR THE META MASTER OF ITS HANDLER
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int port = 0; port < 2; port++){
+			err = HMLibKernel.setArg(argN, HMLibKernelMemory[i]);
+			if(err != CL_SUCCESS){
+				std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
+				return false;
+			}
+			argN++;
+		}
+	}
+
+	q.enqueueTask(HMLibKernel);
+	for(unsigned int i = 0; i < HMLIB_USER_PES; i++){
+		q.enqueueTask(userKernel[i]);
+	}
+	kernelRunning = true;
+	return true;
+	#endif
+}
+
+bool HMLib::initialize(HMLibDevice* device, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers){
 	if(didInitialize){
 		return true;
 	}
+	if(device == nullptr){
+		std::cerr << "No software device passed to initialize" << "\n";
+		return false;
+	}
+	if(handlers == 0 || handlers > HMLIB_HANDLERS){
+		std::cerr << "Number of handlers must be between 1 and " << HMLIB_HANDLERS << ", got: " << handlers << "\n";
+		return false;
+	}
+	if(bufferSections == 0){
+		std::cerr << "Ring needs at least one section" << "\n";
+		return false;
+	}
+
+	softwareDevice = device;
+	sizeRings(bufferSections, inputSize, outputSize, handlers);
+
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		if(!mapRing(i)){
+			return false;
+		}
+		setupRing(i);
+	}
 
+	if(!startKernel()){
+		return false;
+	}
+
+	std::cout << "Initialization complete. Active handlers: " << activeHandlers << "/" << HMLIB_HANDLERS << " Backend: " << device->name() << "\n";
+	didInitialize = true;
+	return true;
+}
+
+bool HMLib::initialize(const std::string binaryFile, const std::string kernelName, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers){
+	if(didInitialize){
+		return true;
+	}
+	if(handlers == 0 || handlers > HMLIB_HANDLERS){
+		std::cerr << "Number of handlers must be between 1 and " << HMLIB_HANDLERS << ", got: " << handlers << "\n";
+		return false;
+	}
+	if(bufferSections == 0){
+		std::cerr << "Ring needs at least one section" << "\n";
+		return false;
+	}
+
+	#ifdef HMLIB_SOFTWARE
+	std::cerr << "Built with HMLIB_SOFTWARE, " << binaryFile << " needs the XRT build. Initialize with an HMLibDevice instead." << "\n";
+	(void)kernelName;
+	(void)outputSize;
+	(void)inputSize;
+	return false;
+	#else
 	std::vector<cl::Device> devices = xcl::get_xil_devices();
 	std::vector<unsigned char> fileBuf = xcl::read_binary_file(binaryFile);
 	cl::Program::Binaries bins{ {fileBuf.data(), fileBuf.size()} };
@@ -67,10 +651,15 @@ bool HMLib::initialize(const std::string binaryFile, const std::string kernelNam
 				std::cerr << "Could not create HMLib kernel, error number: " << err << "\n";
 				return false;
 			}
-			userKernel = cl::Kernel(program, kernelName.c_str(), &err);
-			if(err != CL_SUCCESS){
-				std::cerr << "Could not create look up accelerate kernel, error number: " << err << "\n";
-				return false;
+			//HMLIB_PE_PER_HANDLER USER PE COMPUTE UNITS PER HANDLER, NAMED <kernelName>_<N> IN k2k.cfg
+			//HANDLER H OWNS UNITS H*HMLIB_PE_PER_HANDLER+1 TO (H+1)*HMLIB_PE_PER_HANDLER
+			for(unsigned int j = 0; j < HMLIB_USER_PES; j++){
+				std::string cuName = kernelName + ":{" + kernelName + "_" + std::to_string(j+1) + "}";
+				userKernel[j] = cl::Kernel(program, cuName.c_str(), &err);
+				if(err != CL_SUCCESS){
+					std::cerr << "Could not create user kernel " << cuName << ", error number: " << err << "\n";
+					return false;
+				}
 			}
 		}
 
@@ -83,138 +672,89 @@ bool HMLib::initialize(const std::string binaryFile, const std::string kernelNam
 		return false;
 	}
 
-	//Enable memory for large NDT table space for NDT Lookup
-	cl_mem_ext_ptr_t hostBufferExt;
-	hostBufferExt.flags = XCL_MEM_EXT_HOST_ONLY;
-	hostBufferExt.obj = nullptr;
-	hostBufferExt.param = 0;
-
-	hostMemStates[0].metaSize = 64 * sizeof(char);
-	hostMemStates[0].inputSize = inputSize;
-	hostMemStates[0].outSize = outputSize/* + hostMemStates[0].metaSize*/;
-	hostMemStates[0].oneEntry = hostMemStates[0].inputSize + hostMemStates[0].metaSize + hostMemStates[0].outSize;
-	hostMemStates[0].bufferSections = bufferSections;
+	sizeRings(bufferSections, inputSize, outputSize, handlers);
 
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-		HMLibKernelMemory[i] = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, hostMemStates[0].oneEntry * hostMemStates[0].bufferSections, &hostBufferExt, &err);
-		if(err != CL_SUCCESS){
-			std::cerr << "Could not allocate buffer for HMLibKernelMemory, error number: " << err << "\n";
-			return EXIT_FAILURE;
+		if(!mapRing(i)){
+			return false;
 		}
+		setupRing(i);
 	}
 
-	//Enqueue kernel to start HMLib kernel
-	int argN = 0;
-	err = HMLibKernel.setArg(argN, (unsigned int)hostMemStates[0].bufferSections);
-	if(err != CL_SUCCESS){
-		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
-		return EXIT_FAILURE;
+	if(!startKernel()){
+		return false;
 	}
-	argN++;
 
-	err = HMLibKernel.setArg(argN, (unsigned int)(hostMemStates[0].inputSize/BUS_WIDTH_BYTES));
-	if(err != CL_SUCCESS){
-		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
-		return EXIT_FAILURE;
-	}
-	argN++;
+	std::cout << "Initialization complete. Active handlers: " << activeHandlers << "/" << HMLIB_HANDLERS << " Copy engine: " << (copyEngine == HMLIB_COPY_AVX512 ? "AVX-512" : (copyEngine == HMLIB_COPY_AVX2 ? "AVX2" : "memcpy"))
+		<< " Wait policy: " << (waitPolicy == HMLIB_WAIT_SPIN ? "spin" : (waitPolicy == HMLIB_WAIT_SPIN_YIELD ? "spin-yield" : "spin-park")) << "\n";
+	didInitialize = true;
+	return true;
+	#endif
+}
 
-	err = HMLibKernel.setArg(argN, (unsigned int)(hostMemStates[0].outSize/BUS_WIDTH_BYTES));
-	if(err != CL_SUCCESS){
-		std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
-		return EXIT_FAILURE;
+bool HMLib::reconfigure(const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers){
+	if(!didInitialize){
+		std::cerr << "HMLib Object not initialized! Initialize before calling reconfigure." << "\n";
+		return false;
 	}
-	argN++;
-	
-	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-		err = HMLibKernel.setArg(argN, HMLibKernelMemory[i]);
-		if(err != CL_SUCCESS){
-			std::cerr << "Could not set argument for bundle host memory accelerate kernel, error number: " << err << "\n";
-			return EXIT_FAILURE;
-		}
-		argN++;
+	if(asyncRunning || reactorRunning){
+		std::cerr << "Call stopAsync and stopReactor before calling reconfigure." << "\n";
+		return false;
 	}
-
-
-	//Map to host for setting values and set other copies of hmStates;
-	for(unsigned int i = 1; i < HMLIB_HANDLERS; i++){
-		hostMemStates[i].oneEntry = hostMemStates[0].oneEntry;
-		hostMemStates[i].bufferSections = hostMemStates[0].bufferSections;
-		hostMemStates[i].outSize = hostMemStates[0].outSize;
-		hostMemStates[i].inputSize = hostMemStates[0].inputSize;
-		hostMemStates[i].metaSize = hostMemStates[0].metaSize;
+	if(handlers == 0 || handlers > HMLIB_HANDLERS){
+		std::cerr << "Number of handlers must be between 1 and " << HMLIB_HANDLERS << ", got: " << handlers << "\n";
+		return false;
+	}
+	if(bufferSections == 0){
+		std::cerr << "Ring needs at least one section" << "\n";
+		return false;
+	}
+	if(kernelRunning && !stopKernel()){
+		return false;
 	}
 
-	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
-
-		HMLibMappedMem[i] = (char*)q.enqueueMapBuffer(HMLibKernelMemory[i], CL_TRUE, CL_MAP_WRITE, 0, hostMemStates[i].oneEntry * hostMemStates[i].bufferSections, nullptr, nullptr, &err);
-		if(err != CL_SUCCESS){
-			std::cerr << "Could not map HMLibMappedMem, error number: " << err << "\n";
-			return EXIT_FAILURE;
-		}
-
-		std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
-        	std::chrono::duration<double> duration = t2 - t1;
-        	std::cout << "MAP TIME NS: " <<  std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() << "\n";
+	//THE KERNELS RETURN ON THE EXIT CODE, WAIT FOR THEM BEFORE THE RINGS CHANGE UNDER THEM
+	if(softwareDevice != nullptr){
+		softwareDevice->finish();
+	}
+	#ifndef HMLIB_SOFTWARE
+	else{
+		q.finish();
+	}
+	#endif
 
-		hostMemStates[i].HMLibID = i;
-		hostMemStates[i].metaStart = HMLibMappedMem[i];
-		hostMemStates[i].metaEnd = HMLibMappedMem[i] + hostMemStates[i].bufferSections * hostMemStates[i].metaSize;
-		hostMemStates[i].inputStart = hostMemStates[i].metaEnd;
-		hostMemStates[i].inputEnd = hostMemStates[i].inputStart + hostMemStates[i].inputSize * hostMemStates[i].bufferSections;
-		hostMemStates[i].outputStart = hostMemStates[i].inputEnd;
+	sizeRings(bufferSections, inputSize, outputSize, handlers);
 
-		hostMemStates[i].outputEnd = hostMemStates[i].outputStart + hostMemStates[i].outSize * hostMemStates[i].bufferSections;
-	
-		hostMemStates[i].inputMetaPtr = hostMemStates[i].metaStart;
-		hostMemStates[i].inputPtr = hostMemStates[i].metaEnd;
-		hostMemStates[i].programCounter = 0;
-		hostMemStates[i].totalSize = 0;
-		hostMemStates[i].timeWaitSend = 0;
-		hostMemStates[i].copyTimeIn = 0;
-		hostMemStates[i].oneSendTime = 0;
-		
-		hostMemStates[i].outputMetaPtr = hostMemStates[i].metaStart;
-		hostMemStates[i].outputPtr = hostMemStates[i].outputStart;
-		hostMemStates[i].copyTimeOut = 0;
-		hostMemStates[i].latencies = 0;
-		hostMemStates[i].prefetchHelp = 0;
-		hostMemStates[i].computeLatency = 0;
-		hostMemStates[i].threadProcessed = 0;
-
-		hostMemStates[i].oneReadTime = 0;
-		hostMemStates[i].overallTime = 0;
-		hostMemStates[i].timeWaitRead = 0;
-
-		hostMemStates[i].full = new std::atomic<unsigned int>();
-		*(hostMemStates[i].full) = 0;
-
-		memset(HMLibMappedMem[i], 0, hostMemStates[i].metaSize * hostMemStates[i].bufferSections + hostMemStates[i].oneEntry * hostMemStates[i].bufferSections);
-
-		std::cout << "INSPECT HANDLER META BUFFER INITIALIZE: " << i << " " << (void*)HMLibMappedMem[i] << "\n";
-		for(unsigned int k = 0; k < hostMemStates[i].bufferSections; k++){
-			std::cout << "META BUFFER SECTION: " << k << "\n";
-			for(unsigned int l = 0; l < hostMemStates[i].metaSize; l++){
-				std::cout << (int)*(HMLibMappedMem[i] + hostMemStates[i].metaSize*k + l) << " " << " ";
-			}
-			std::cout << "\n";
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		releaseRing(i);
+		if(!mapRing(i)){
+			return false;
 		}
+		setupRing(i);
 	}
 
-	q.enqueueTask(HMLibKernel);
-	q.enqueueTask(userKernel);
+	if(!startKernel()){
+		return false;
+	}
 
-	std::cout << "Initialization complete" << "\n";
-	didInitialize = true;
+	std::cout << "Reconfigure complete. Active handlers: " << activeHandlers << "/" << HMLIB_HANDLERS << " Sections: " << hostMemStates[0].bufferSections
+		<< " Input slot: " << hostMemStates[0].inputSize << " Output slot: " << hostMemStates[0].outSize << "\n";
 	return true;
 }
 
+unsigned int HMLib::getActiveHandlers(){
+	return activeHandlers;
+}
+
 struct HMLibUniqueHandler* HMLib::getHMLibUniqueHandler(unsigned int HMLibID){
 	if(!didInitialize){
 		std::cerr << "HMLib Object not initialized! Initialize before calling getHMLibUniqueHandler." << "\n";
 		return nullptr;
 	}
+	if(HMLibID >= activeHandlers){
+		std::cerr << "HMLib handler ID: " << HMLibID << " is not active. Active handlers: " << activeHandlers << "\n";
+		return nullptr;
+	}
 	if(hmStatesTracker[HMLibID]){
 		std::cerr << "Someone is using this HMLib object. ID: " << HMLibID << "\n";
 		return nullptr;
@@ -233,7 +773,7 @@ bool HMLib::returnHMLibUniqueHandler(struct HMLibUniqueHandler* val, unsigned in
 		std::cerr << "HMLib Object not initialized! Initialize before calling returnHMLibUniqueHandler." << "\n";
 		return false;
 	}
-	if(!hmStatesTracker[HMLibID]){
+	if(HMLibID >= activeHandlers || !hmStatesTracker[HMLibID]){
 		std::cerr << "HMLib object. ID: " << HMLibID << " not in use." << "\n";
 		return false;
 	}
@@ -246,10 +786,10 @@ bool HMLib::returnHMLibUniqueHandler(struct HMLibUniqueHandler* val, unsigned in
 	return true;
 }
 
-int HMLib::sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+int HMLib::reserveInputSlot(char*& slot, unsigned int& slotSize, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const unsigned int bytes, const HMLibPriority priority){
 	if(!didInitialize){
 		printLock.lock();
-		std::cerr << "HMLib Object not initialized! Initialize before calling sendInput." << "\n";
+		std::cerr << "HMLib Object not initialized! Initialize before calling reserveInputSlot." << "\n";
 		printLock.unlock();
 		return -2;
 	}
@@ -259,55 +799,281 @@ int HMLib::sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int size
 		printLock.unlock();
 		return -2;
 	}
+	if(hmo->inputReserved){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- Slot already reserved. Call commitInput first." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(priority == HMLIB_PRIORITY_HIGH && HMLIB_PRIORITY_SECTIONS == 0){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- High priority needs a build with HMLIB_PRIORITY_SECTIONS." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	//A REQUEST LARGER THAN ONE SLOT TAKES SEVERAL CONTIGUOUS SLOTS
+	unsigned int span = (bytes == 0) ? 1 : (bytes + hmo->inputSize - 1)/hmo->inputSize;
+	if(span > hmo->bufferSections){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- Input length is too long for the ring: " << bytes << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	unsigned int metaSection = sectionOfMeta(hmo, (priority == HMLIB_PRIORITY_HIGH) ? hmo->priorityMetaPtr : hmo->inputMetaPtr);
+	unsigned int firstSlot = 0;
 
 	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
-	unsigned int currentPE = hmo->programCounter % 1;//PE_PER_HANDLER;
-	char* metaPtr = hmo->inputMetaPtr;
-	char* inputPtr = hmo->inputPtr;
+	//META SECTIONS ARE STILL USED IN ORDER, SO THE SENDER ALSO WAITS WHEN IT WRAPS ONTO A SECTION THAT IS NOT RELEASED YET.
+	//releaseOutput WAKES A PARKED SENDER ONCE SLOTS ARE HANDED BACK. AN EMPTY RING ALWAYS TAKES THE REQUEST
+	HMLibWaiter waiter(waitPolicy, timeoutNS);
+	unsigned int used = hmo->full->load();
+	while(testBit(hmo->inFlightBits, metaSection) || !findFreeSlots(hmo, span, firstSlot)){
+		hmo->sendNeed->store(span);
+		if(!waiter.pause(hmo->full, used)){
+			hmo->sendNeed->store(0);
+			hmo->timeWaitSend += waiter.elapsedNS();
+			return -1;
+		}
+		used = hmo->full->load();
+	}
+	hmo->sendNeed->store(0);
+	hmo->timeWaitSend += waiter.elapsedNS();
+
+	//THE SLOTS STAY OWNED BY THE CALLER UNTIL commitInput PUBLISHES THEM TO THE KERNEL
+	hmo->inputReserved = true;
+	hmo->reserveSpan = span;
+	hmo->reserveSlot = firstSlot;
+	hmo->reservePriority = priority;
+	hmo->reserveDescriptors = 0;
+	hmo->reserveStart = std::chrono::duration_cast<std::chrono::nanoseconds>(t1.time_since_epoch()).count();
+	slot = hmo->inputStart + firstSlot * hmo->inputSize;
+	slotSize = span * hmo->inputSize;
+	return 0;
+}
 
-	while(true){
-		if(hmo->full->load() == hmo->bufferSections){
-			std::chrono::steady_clock::time_point giveUpTimer = std::chrono::steady_clock::now();
-			std::chrono::duration<double> missed = giveUpTimer - t1;
-			uint64_t missedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(missed).count();
-
-			if(missedTime >= timeoutNS && timeoutNS != 0){
-				hmo->timeWaitSend += missedTime;
-				return -1;
+int HMLib::commitInput(const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchCount, const uint16_t code, struct HMLibUniqueHandler* hmo, const uint32_t argument, const uint64_t operand, const uint8_t affinity){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling commitInput." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(!hmo->inputReserved){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- No slot reserved. Call reserveInputSlot first." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	//A HIGH PRIORITY REQUEST TAKES THE NEXT LINE AND PROGRAM COUNTER OF ITS OWN RING
+	bool high = hmo->reservePriority == HMLIB_PRIORITY_HIGH;
+	unsigned int& ringProgramCounter = high ? hmo->priorityProgramCounter : hmo->programCounter;
+	unsigned int currentPE = ringProgramCounter % HMLIB_PE_PER_HANDLER;
+	//THE META LINE IS BUILT LOCALLY AND PUBLISHED TO THE RING IN ONE 64 BYTE STORE
+	alignas(64) char metaLine[64] = {0};
+	char* metaPtr = metaLine;
+	char* ringMetaPtr = high ? hmo->priorityMetaPtr : hmo->inputMetaPtr;
+
+	//EVERY BATCHED INPUT MUST START ON A 64 BYTE LINE OF THE RESERVED SLOT
+	unsigned int totalSize = 0;
+	unsigned int batchSizes[MAX_BATCH_SIZE] = {0};
+	for(unsigned int i = 0; i < batchCount && i < MAX_BATCH_SIZE; i++){
+		batchSizes[i] = sizes[i];
+		totalSize += sizes[i];
+		totalSize = customRound(totalSize,64);
+	}
+
+	if(batchCount == 0 || batchCount > MAX_BATCH_SIZE || totalSize > hmo->reserveSpan * hmo->inputSize){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << " " << currentPE << ": --- Invalid batch: " << batchCount << " inputs, " << totalSize << " bytes" << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	for(unsigned int i = 0; i < batchCount; i++){
+		hmo->totalSize += batchSizes[i];
+	}
+
+	//META SECTIONS ARE USED ONE PER REQUEST IN ORDER, THE DATA SLOT TRAVELS IN THE META LINE
+	unsigned int metaSection = sectionOfMeta(hmo, ringMetaPtr);
+	unsigned int firstSlot = hmo->reserveSlot;
+	hmo->spans[metaSection].slot = firstSlot;
+	hmo->spans[metaSection].span = hmo->reserveSpan;
+
+	//THE SECTION IS MARKED IN FLIGHT BEFORE ITS PROGRAM COUNTER IS PUBLISHED, releaseOutput RELIES ON THAT ORDER
+	setBits(hmo->slotBits, firstSlot, hmo->reserveSpan, true);
+	setBits(hmo->inFlightBits, metaSection, 1, true);
+	(*(hmo->full)) += hmo->reserveSpan;
+	ringProgramCounter++;
+
+	//THE SLOT IS OVERWRITTEN WITH THE INPUTS AS ONE LZ4 BLOCK WHEN THAT SAVES AT LEAST A LINE, unpackDataUser EXPANDS IT AGAIN.
+	//A SLOT HOLDING DESCRIPTORS IS SENT AS IS
+	unsigned int packedLines = 0;
+	unsigned int descriptors = hmo->reserveDescriptors;
+	#if HMLIB_COMPRESS
+		char* slot = hmo->inputStart + firstSlot * hmo->inputSize;
+		if(descriptors == 0 && totalSize > 64 && totalSize <= HMLIB_COMPRESS_MAX_LINES * 64){
+			unsigned int packedSize = lz4Compress(slot, totalSize, hmo->packBuffer, totalSize - 64);
+			if(packedSize != 0){
+				memcpy(slot, hmo->packBuffer, packedSize);
+				packedLines = customRound(packedSize,64)/64;
+				hmo->packedSize += packedSize;
+				hmo->unpackedSize += totalSize;
 			}
-		}else{
-			std::chrono::steady_clock::time_point spinTimer = std::chrono::steady_clock::now();
-			std::chrono::duration<double> missed = spinTimer - t1;
-			uint64_t missedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(missed).count();
+		}
+	#endif
 
-			hmo->timeWaitSend += missedTime;
-			break;
+	uint64_t sendTimePoint = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	uint16_t stp[4];
+
+	memcpy(stp,&sendTimePoint,sizeof(uint64_t));
+
+	//new
+	//0 send code 0-15
+	//1 recv code 16-31	ON SEND: DESCRIPTORS IN THE SLOT, 0 WHEN THE INPUTS ARE IN IT
+	//2 batchSize 32-39	ON SEND: AFFINITY 40-47, THE PE IS affinity % PEs WHEN NOT 0
+	//3 prefetch help 48-63	ON SEND: LINES OF THE LZ4 BLOCK, 0 WHEN SENT AS IS
+	//4 numof64iters 64-95	2
+	//5 send size1 96-127	3
+	//6 send size2 128-159	4
+	//7 send size3 160-191	5
+	//8 send size4 192-223	6
+	//9 out size1 224-255	7	ON SEND: ARGUMENT FOR THE PE, FORWARDED IN ITS CODE PACKET
+	//10 out size2 256-287	8	ON SEND: OPERAND FOR THE PE (64 BITS), FORWARDED IN ITS CODE PACKET
+	//11 out size3 288-319	9
+	//12 out size4 320-351	10	ON SEND: FIRST DATA SLOT OF THE REQUEST
+	//13 latency 352-415
+	//14 sync for checkoutput thread 416-447	13	INSIDE THE KERNEL: META SECTION THE RESULT IS WRITTEN BACK TO
+	//15 send pc 448-479
+	//16 recv pc 480-511
+
+	//0-0,1-32,2-64,3-96,4-128,5-160,6-192,7-224,8-256,9-288,10-320,11-352,12-384,13-416,14-448,15-480
+
+	((uint16_t*)metaPtr)[0] = code;
+	((uint16_t*)metaPtr)[1] = descriptors;
+	((uint8_t*)metaPtr)[4] = batchCount;
+	((uint8_t*)metaPtr)[5] = affinity;
+	((uint16_t*)metaPtr)[3] = packedLines;
+	((uint32_t*)metaPtr)[2] = totalSize/64;
+	((uint32_t*)metaPtr)[3] = batchSizes[0];
+	((uint32_t*)metaPtr)[4] = batchSizes[1];
+	((uint32_t*)metaPtr)[5] = batchSizes[2];
+	((uint32_t*)metaPtr)[6] = batchSizes[3];
+	((uint32_t*)metaPtr)[7] = argument;
+	((uint64_t*)metaPtr)[4] = operand;
+	((uint32_t*)metaPtr)[10] = firstSlot;
+	
+	((uint16_t*)metaPtr)[22] = stp[0];
+	((uint16_t*)metaPtr)[23] = stp[1];
+	((uint16_t*)metaPtr)[24] = stp[2];
+	((uint16_t*)metaPtr)[25] = stp[3];
+
+	((unsigned int*)metaPtr)[13] = 1; 
+	((unsigned int*)metaPtr)[14] = ringProgramCounter;
+
+	publishMeta(ringMetaPtr, metaLine);
+	ringDoorbell(hmo);
+
+	#ifdef HW_SIM
+		printLock.lock();
+		unsigned int section = metaSection;
+		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Program counter: " << ringProgramCounter << "\n";
+		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Write data" << "\n";
+		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Inspect: ";
+		for(unsigned l = 0; l < hmo->metaSize; l++){
+			std::cout << (int)metaPtr[l] << " ";
+		}
+		std::cout << "\n";
+		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Buffer section: " << section << " Total Size: " << totalSize << "\n";
+		unsigned int position = 0;
+		for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
+			if(batchSizes[i] != 0){
+				std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- " << batchSizes[i] << "\n";
+				position += batchSizes[i];
+				position = customRound(position,64);
+			}
+		}
+		printLock.unlock();
+	#endif
+
+
+	if(high){
+		hmo->priorityMetaPtr += hmo->metaSize;
+		if(hmo->priorityMetaPtr == hmo->priorityEnd){
+			hmo->priorityMetaPtr = hmo->priorityStart;
+		}
+	}else{
+		hmo->inputMetaPtr += hmo->metaSize;
+		if(hmo->inputMetaPtr == hmo->metaEnd){
+			hmo->inputMetaPtr = hmo->metaStart;
 		}
 	}
+	hmo->inputPtr = hmo->inputStart + (firstSlot + hmo->reserveSpan) * hmo->inputSize;
+	if(hmo->inputPtr == hmo->inputEnd){
+		hmo->inputPtr = hmo->inputStart;
+	}
+
+	hmo->inputReserved = false;
+	hmo->reserveDescriptors = 0;
+	uint64_t t2 = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	hmo->copyTimeIn += t2 - hmo->reserveStart;
+
+	return 0;
+}
 
+int HMLib::sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling sendInput." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	unsigned int currentPE = hmo->programCounter % HMLIB_PE_PER_HANDLER;
+
+	//PACK AS MANY OF THE REQUESTED INPUTS AS FIT IN ONE SLOT, EACH ONE STARTS ON A 64 BYTE LINE
+	//AN INPUT LARGER THAN ONE SLOT GOES ALONE OVER SEVERAL SLOTS
 	unsigned int totalSize = 0;
+	unsigned int batchSizes[MAX_BATCH_SIZE] = {0};
 	batched = 0;
-	for(unsigned int i = 0; i < batchRequest; i++){
-		if(totalSize + sizes[i] <= hmo->inputSize){
+	for(unsigned int i = 0; i < batchRequest && i < MAX_BATCH_SIZE; i++){
+		if(sizes[i] != 0 && (batched == 0 || customRound(totalSize + sizes[i],64) <= hmo->inputSize)){
+			batchSizes[i] = sizes[i];
 			batched++;
 			totalSize += sizes[i];
 			totalSize = customRound(totalSize,64);
-			hmo->totalSize += sizes[i];
 		}else{
 			break;
 		}
 	}
 
-	if(totalSize > hmo->inputSize){
+	if(batched == 0){
 		printLock.lock();
-		std::cerr << "Input " << hmo->HMLibID << " " << currentPE << ": --- Input length is too long: " << totalSize << "\n";
+		std::cerr << "Input " << hmo->HMLibID << " " << currentPE << ": --- Input length is too long: " << (batchRequest ? sizes[0] : 0) << "\n";
 		printLock.unlock();
 		return -2;
 	}
 
-	(*(hmo->full))++;
-	hmo->programCounter++;
+	char* inputPtr;
+	unsigned int slotSize;
+	int ec = reserveInputSlot(inputPtr, slotSize, timeoutNS, hmo, totalSize, priority);
+	if(ec != 0){
+		return ec;
+	}
 
 	if(stevez_debug)
 		std::cout<<"(debug) HMLibL "<< "batch size: " << batched << "\n";
@@ -315,8 +1081,8 @@ int HMLib::sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int size
 	//#ifdef HW_SIM
 		totalSize = 0;
 		for(unsigned int i = 0; i < batched; i++){
-			memcpy(inputPtr+totalSize,buffer[i],sizes[i]);
-			totalSize += sizes[i];
+			copyToRing(inputPtr+totalSize,buffer[i],batchSizes[i]);
+			totalSize += batchSizes[i];
 			if(stevez_debug){
 				std::cout << "(debug) HMLib: " << "Memory copy" << std::endl;
 				std::cout << "(debug) HMLib: " << "sizes" << " " << sizes[i] << std::endl;
@@ -332,131 +1098,301 @@ int HMLib::sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int size
 			std::cout << "\n";
 		}
 
-	/*#else
-		unsigned count64 = 0;
-		for(unsigned int i = 0; i < batched; i++){
-			unsigned int localSize64 = sizes[i];
-			unsigned int getSize = 0;
-			localSize64 = customRound(localSize64, 64);
-			for(unsigned int j = 0; j < localSize64/64; j++){
-				__m512i val = _mm512_set_epi64(0,0,0,0,0,0,0,0);
-				if(getSize + 64 <= sizes[i]){
-					memcpy(&val, buffer[i]+64*j,sizeof(char)*64);
-				}else{
-					memcpy(&val, buffer[i]+64*j,sizeof(char)*(sizes[i] - getSize));
-				}
+	return commitInput(batchSizes, batched, code, hmo, argument, operand, affinity);
+}
 
-				_mm512_stream_si512((__m512i*)(inputPtr+64*count64),val);
-				count64++;
-			}
+int HMLib::sendControl(const char* input, const unsigned int size, const uint16_t code, const uint32_t argument, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling sendControl." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(hmo->full->load() != 0){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- Requests still in flight, drain the handler before sendControl" << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	//THE KERNEL HANDS REQUESTS TO THE PEs OF A HANDLER ROUND ROBIN, SO HMLIB_PE_PER_HANDLER COPIES IN A ROW REACH EACH PE ONCE.
+	//THE RING HAS AT LEAST META_BURST_LINES SECTIONS, ENOUGH FOR ALL OF THEM BEFORE THE FIRST OUTPUT IS TAKEN
+	const char* buffer[MAX_BATCH_SIZE] = {input};
+	unsigned int sizes[MAX_BATCH_SIZE] = {size};
+	for(unsigned int i = 0; i < HMLIB_PE_PER_HANDLER; i++){
+		unsigned int batched = 0;
+		int ec = sendInput(buffer, sizes, 1, batched, code, timeoutNS, hmo, HMLIB_PRIORITY_NORMAL, argument);
+		if(ec != 0){
+			return ec;
 		}
-	#endif*/
-	uint64_t sendTimePoint = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
 
-	unsigned int iterations = totalSize/64;
-	uint16_t stp[4];
-	uint16_t pc[2];
-	uint16_t inSizes[8];
-	uint16_t it[2];
+	for(unsigned int i = 0; i < HMLIB_PE_PER_HANDLER; i++){
+		char* outPtr[MAX_BATCH_SIZE];
+		unsigned int outSizes[MAX_BATCH_SIZE] = {0};
+		unsigned int batchCount = 0;
+		int ec = peekOutput(outPtr, outSizes, batchCount, timeoutNS, hmo);
+		if(ec != 0){
+			return ec;
+		}
+		ec = releaseOutput(hmo);
+		if(ec != 0){
+			return ec;
+		}
+	}
+	return 0;
+}
 
-	memcpy(stp,&sendTimePoint,sizeof(uint64_t));
-	memcpy(pc,&(hmo->programCounter),sizeof(unsigned int));
-	memcpy(inSizes,sizes,sizeof(unsigned int) * 4);
-	memcpy(it,&iterations,sizeof(unsigned int));
+char* HMLib::registerBuffer(const size_t bytes){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling registerBuffer." << "\n";
+		printLock.unlock();
+		return nullptr;
+	}
 
-	//new
-	//0 send code 0-15
-	//1 recv code 16-31
-	//2 batchSize 32-47	
-	//3 prefetch help 48-63
-	//4 numof64iters 64-95	2
-	//5 send size1 96-127	3
-	//6 send size2 128-159	4
-	//7 send size3 160-191	5
-	//8 send size4 192-223	6
-	//9 out size1 224-255	7
-	//10 out size2 256-287	8
-	//11 out size3 288-319	9
-	//12 out size4 320-351	10
-	//13 latency 352-415
-	//14 sync for checkoutput thread 416-447
-	//15 send pc 448-479
-	//16 recv pc 480-511
+	if(bytes == 0){
+		std::cerr << "Registered buffer must not be empty" << "\n";
+		return nullptr;
+	}
+
+	struct HMLibRegisteredBuffer registered;
+	registered.bytes = (bytes + 4095)/4096*4096;
+	registered.region = false;
+	registered.carved = 0;
+	if(softwareDevice != nullptr){
+		registered.host = (char*)aligned_alloc(4096, registered.bytes);
+		if(registered.host == nullptr){
+			std::cerr << "Could not allocate registered buffer of " << bytes << " bytes" << "\n";
+			return nullptr;
+		}
+		registered.deviceAddress = (uint64_t)registered.host;
+	}else{
+		#ifdef HMLIB_SOFTWARE
+		return nullptr;
+		#else
+		cl_int err = 0;
+		cl_mem_ext_ptr_t hostBufferExt;
+		hostBufferExt.flags = XCL_MEM_EXT_HOST_ONLY;
+		hostBufferExt.obj = nullptr;
+		hostBufferExt.param = 0;
+
+		registered.buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_EXT_PTR_XILINX, registered.bytes, &hostBufferExt, &err);
+		if(err != CL_SUCCESS){
+			std::cerr << "Could not allocate registered buffer, error number: " << err << "\n";
+			return nullptr;
+		}
+		registered.host = (char*)q.enqueueMapBuffer(registered.buffer, CL_TRUE, CL_MAP_WRITE, 0, registered.bytes, nullptr, nullptr, &err);
+		if(err != CL_SUCCESS){
+			std::cerr << "Could not map registered buffer, error number: " << err << "\n";
+			return nullptr;
+		}
+		err = xclGetMemObjDeviceAddress(registered.buffer.get(), device.get(), sizeof(uint64_t), &registered.deviceAddress);
+		if(err != CL_SUCCESS){
+			std::cerr << "Could not get the device address of registered buffer, error number: " << err << "\n";
+			q.enqueueUnmapMemObject(registered.buffer, registered.host);
+			return nullptr;
+		}
+		#endif
+	}
+
+	std::lock_guard<std::mutex> guard(registeredLock);
+	registeredBuffers.push_back(registered);
+	return registered.host;
+}
 
-	//0-0,1-32,2-64,3-96,4-128,5-160,6-192,7-224,8-256,9-288,10-320,11-352,12-384,13-416,14-448,15-480
+bool HMLib::unregisterBuffer(char* buffer){
+	std::lock_guard<std::mutex> guard(registeredLock);
+	for(unsigned int k = 0; k < registeredBuffers.size(); k++){
+		if(registeredBuffers[k].host == buffer){
+			//THE SUB-BUFFERS OF A REGION GO WITH IT
+			char* end = buffer + registeredBuffers[k].bytes;
+			for(unsigned int c = 0; c < HMLIB_PINNED_CLASSES; c++){
+				pinnedFree[c].erase(std::remove_if(pinnedFree[c].begin(), pinnedFree[c].end(), [&](char* sub){ return sub >= buffer && sub < end; }), pinnedFree[c].end());
+			}
+			for(std::unordered_map<char*, unsigned int>::iterator it = pinnedInUse.begin(); it != pinnedInUse.end();){
+				if(it->first >= buffer && it->first < end){
+					it = pinnedInUse.erase(it);
+				}else{
+					++it;
+				}
+			}
+			if(softwareDevice != nullptr){
+				free(buffer);
+			}
+			#ifndef HMLIB_SOFTWARE
+			else{
+				q.enqueueUnmapMemObject(registeredBuffers[k].buffer, buffer);
+			}
+			#endif
+			registeredBuffers.erase(registeredBuffers.begin() + k);
+			return true;
+		}
+	}
+	std::cerr << "Buffer was not registered: " << (void*)buffer << "\n";
+	return false;
+}
 
-	//#ifdef HW_SIM
-		((uint16_t*)metaPtr)[0] = code;
-		((uint16_t*)metaPtr)[2] = batched;
-		((uint32_t*)metaPtr)[2] = totalSize/64;
-		((uint32_t*)metaPtr)[3] = sizes[0];
-		((uint32_t*)metaPtr)[4] = sizes[1];
-		((uint32_t*)metaPtr)[5] = sizes[2];
-		((uint32_t*)metaPtr)[6] = sizes[3];
-		
-		for(unsigned int i = 0; i < 4; i++){
-			((uint32_t*)metaPtr)[7+i] = 0;
+bool HMLib::registerRegion(const size_t bytes){
+	char* host = registerBuffer(bytes);
+	if(host == nullptr){
+		return false;
+	}
+	std::lock_guard<std::mutex> guard(registeredLock);
+	for(unsigned int k = 0; k < registeredBuffers.size(); k++){
+		if(registeredBuffers[k].host == host){
+			registeredBuffers[k].region = true;
 		}
+	}
+	return true;
+}
 
-		((uint16_t*)metaPtr)[22] = stp[0];
-		((uint16_t*)metaPtr)[23] = stp[1];
-		((uint16_t*)metaPtr)[24] = stp[2];
-		((uint16_t*)metaPtr)[25] = stp[3];
+char* HMLib::allocatePinned(const size_t bytes){
+	unsigned int sizeClass = 0;
+	size_t classBytes = HMLIB_PINNED_MIN_BYTES;
+	while(classBytes < bytes && sizeClass < HMLIB_PINNED_CLASSES){
+		classBytes <<= 1;
+		sizeClass++;
+	}
+	if(bytes == 0 || sizeClass == HMLIB_PINNED_CLASSES){
+		std::cerr << "Pinned buffer size out of range: " << bytes << "\n";
+		return nullptr;
+	}
 
-		((unsigned int*)metaPtr)[13] = 1; 
-		((unsigned int*)metaPtr)[14] = hmo->programCounter;
-	/*#else
-		
-		__m512i val = _mm512_set_epi16(
-			0,0,pc[1],pc[0],0,1,stp[3],stp[2],
-			stp[1],stp[0],0,0,0,0,0,0,
-			0,0,inSizes[7],inSizes[6],inSizes[5],inSizes[4],inSizes[3],inSizes[2],
-			inSizes[1],inSizes[0],it[1],it[0],0,batched,0,code);
+	//A FREED SUB-BUFFER OF THE SAME CLASS FIRST, OTHERWISE A NEW ONE CARVED FROM THE FIRST REGION WITH ROOM
+	std::lock_guard<std::mutex> guard(registeredLock);
+	char* buffer = nullptr;
+	if(!pinnedFree[sizeClass].empty()){
+		buffer = pinnedFree[sizeClass].back();
+		pinnedFree[sizeClass].pop_back();
+	}else{
+		for(unsigned int k = 0; k < registeredBuffers.size() && buffer == nullptr; k++){
+			struct HMLibRegisteredBuffer& registered = registeredBuffers[k];
+			if(registered.region && registered.bytes - registered.carved >= classBytes){
+				buffer = registered.host + registered.carved;
+				registered.carved += classBytes;
+			}
+		}
+	}
+	if(buffer == nullptr){
+		std::cerr << "No pinned region has room for " << bytes << " bytes. Call registerRegion first." << "\n";
+		return nullptr;
+	}
+	pinnedInUse[buffer] = sizeClass;
+	return buffer;
+}
 
-		_mm512_stream_si512((__m512i*)metaPtr,val);
-	#endif*/
+bool HMLib::freePinned(char* buffer){
+	std::lock_guard<std::mutex> guard(registeredLock);
+	std::unordered_map<char*, unsigned int>::iterator it = pinnedInUse.find(buffer);
+	if(it == pinnedInUse.end()){
+		std::cerr << "Pinned buffer was not allocated or is already free: " << (void*)buffer << "\n";
+		return false;
+	}
+	pinnedFree[it->second].push_back(buffer);
+	pinnedInUse.erase(it);
+	return true;
+}
 
-	#ifdef HW_SIM
-		printLock.lock();
-		unsigned int section = hmo->bufferSections - (hmo->metaEnd - metaPtr)/hmo->metaSize;
-		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Program counter: " << hmo->programCounter << "\n";
-		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Write data" << "\n";
-		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Inspect: ";
-		for(unsigned l = 0; l < hmo->metaSize; l++){
-			std::cout << (int)metaPtr[l] << " ";
-		}
-		std::cout << "\n";
-		std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- Buffer section: " << section << " Total Size: " << totalSize << "\n";
-		unsigned int position = 0;
-		for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
-			if(sizes[i] != 0){
-				std::cout << "HMLib " << hmo->HMLibID << " " << currentPE << ": --- " << sizes[i] << "\n";
-				position += sizes[i];
-				position = customRound(position,64);
+//bytes FROM ptr MUST LIE IN ONE REGISTERED BUFFER AND START ON A 64 BYTE LINE
+bool HMLib::deviceAddressOf(const char* ptr, const unsigned int bytes, uint64_t& address){
+	std::lock_guard<std::mutex> guard(registeredLock);
+	for(unsigned int k = 0; k < registeredBuffers.size(); k++){
+		const struct HMLibRegisteredBuffer& registered = registeredBuffers[k];
+		if(ptr >= registered.host && ptr + bytes <= registered.host + registered.bytes){
+			if((ptr - registered.host) % 64 != 0){
+				return false;
 			}
+			address = registered.deviceAddress + (ptr - registered.host);
+			return true;
 		}
+	}
+	return false;
+}
+
+int HMLib::sendInputGather(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling sendInputGather." << "\n";
 		printLock.unlock();
-	#endif
+		return -2;
+	}
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(!HMLIB_GATHER){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- Sending by reference needs a build with HMLIB_GATHER." << "\n";
+		printLock.unlock();
+		return -2;
+	}
 
+	//ONE (LINE OFFSET, LINES, BYTES) DESCRIPTOR PER INPUT. THE OFFSET IS TAKEN FROM THE RING AND WRAPS AROUND 64 BITS
+	//FOR A BUFFER BELOW IT, THE KERNEL ADDS IT TO ITS RING POINTER THE SAME WAY
+	alignas(64) char descriptorLine[64] = {0};
+	unsigned int totalSize = 0;
+	unsigned int batchSizes[MAX_BATCH_SIZE] = {0};
+	batched = 0;
+	for(unsigned int i = 0; i < batchRequest && i < MAX_BATCH_SIZE; i++){
+		if(sizes[i] == 0){
+			break;
+		}
+		uint64_t address;
+		if(!deviceAddressOf(buffer[i], sizes[i], address)){
+			printLock.lock();
+			std::cerr << "Input " << hmo->HMLibID << ": --- Input is not on a 64 byte line of a registered buffer: " << (void*)buffer[i] << "\n";
+			printLock.unlock();
+			return -2;
+		}
+		((uint64_t*)descriptorLine)[2*i] = (uint64_t)((int64_t)(address - ringDeviceAddress[hmo->HMLibID])/64);
+		((uint32_t*)descriptorLine)[4*i+2] = customRound(sizes[i],64)/64;
+		((uint32_t*)descriptorLine)[4*i+3] = sizes[i];
+		batchSizes[i] = sizes[i];
+		batched++;
+		totalSize += customRound(sizes[i],64);
+	}
 
-	hmo->inputMetaPtr += hmo->metaSize;
-	hmo->inputPtr += hmo->inputSize;
-	if(hmo->inputMetaPtr == hmo->metaEnd){
-		hmo->inputMetaPtr = hmo->metaStart;
-		hmo->inputPtr = hmo->inputStart;
+	if(batched == 0){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- No input to send" << "\n";
+		printLock.unlock();
+		return -2;
 	}
 
-	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
-	std::chrono::duration<double> duration = t2 - t1;
-	hmo->copyTimeIn += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	char* slot;
+	unsigned int slotSize;
+	int ec = reserveInputSlot(slot, slotSize, timeoutNS, hmo, totalSize, priority);
+	if(ec != 0){
+		return ec;
+	}
+	copyToRing(slot, descriptorLine, 64);
+	hmo->reserveDescriptors = batched;
 
-	return 0;
+	return commitInput(batchSizes, batched, code, hmo, argument, operand, affinity);
 }
 
-int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+int HMLib::peekOutput(char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	return peekOutputFrom(false, outPtr, outSizes, batchCount, timeoutNS, hmo);
+}
+
+int HMLib::peekAnyOutput(char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	return peekOutputFrom(true, outPtr, outSizes, batchCount, timeoutNS, hmo);
+}
+
+//IN ORDER: WAIT ON THE OLDEST SECTION NOT YET RELEASED. ANY ORDER: SCAN EVERY SECTION IN FLIGHT FOR ONE THE KERNEL HAS FINISHED
+int HMLib::peekOutputFrom(const bool anyOrder, char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
 	if(!didInitialize){
 		printLock.lock();
-		std::cerr << "HMLib Object not initialized! Initialize before calling checkOutput." << "\n";
+		std::cerr << "HMLib Object not initialized! Initialize before calling peekOutput." << "\n";
 		printLock.unlock();
 		return -2;
 	}
@@ -466,47 +1402,60 @@ int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MA
 		printLock.unlock();
 		return -2;
 	}
+	if(hmo->outputPeeked){
+		printLock.lock();
+		std::cerr << "Thread Receiver: " << hmo->HMLibID << " --- Output already peeked. Call releaseOutput first." << "\n";
+		printLock.unlock();
+		return -2;
+	}
 
 	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
 	char* hmMetaPtr = hmo->outputMetaPtr;
-	char* outputPtr = hmo->outputPtr;
-
-	//Copy the result to new buffer
 
 	uint64_t tl;
 	unsigned int preHelp, status;
 	unsigned int outputLengths[MAX_BATCH_SIZE] = {0};
 	unsigned int inputLengths[MAX_BATCH_SIZE] = {0};
-	char metaPtr[64];
+	char* metaPtr = hmo->outputMeta;
 
+	//THE KERNEL WRITES THE STATUS OVER PCIE, NOTHING CAN WAKE A PARKED RECEIVER SO IT SLEEPS WITH BACKOFF
+	HMLibWaiter waiter(waitPolicy, timeoutNS);
 	while(true){
-		memcpy(metaPtr,hmMetaPtr,64);
-		status = ((unsigned int *) metaPtr)[13];
+		if(anyOrder){
+			hmMetaPtr = findDoneSection(hmo);
+		}
+		status = 0;
+		if(hmMetaPtr != nullptr){
+			memcpy(metaPtr,hmMetaPtr,64);
+			status = ((unsigned int *) metaPtr)[13];
+		}
 
 		if(status == 2 /*&& *((unsigned int *)(outputPtr+hmo->outSize-hmo->metaSize)) == 0xDEADBEEF*/){
-			std::chrono::steady_clock::time_point spinTimer = std::chrono::steady_clock::now();
-			std::chrono::duration<double> missed = spinTimer - t1;
-			uint64_t missedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(missed).count();
-
-			hmo->timeWaitRead += missedTime;
+			hmo->timeWaitRead += waiter.elapsedNS();
 			break;
-		}else{
-			std::chrono::steady_clock::time_point giveUpTimer = std::chrono::steady_clock::now();
-			std::chrono::duration<double> missed = giveUpTimer - t1;
-			uint64_t missedTime = std::chrono::duration_cast<std::chrono::nanoseconds>(missed).count();
-
-			if(missedTime >= timeoutNS && timeoutNS != 0){
-				hmo->timeWaitRead += missedTime;
-				return -1;
-			}
+		}else if(!waiter.pause(nullptr, 0)){
+			hmo->timeWaitRead += waiter.elapsedNS();
+			return -1;
 		}
 	}
 	
 	
 	uint64_t receiveTimePoint = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
-	uint16_t batchCount = ((uint16_t*)metaPtr)[2];
+	//THE OUTPUT USES THE SAME SLOTS OF THE OUTPUT AREA AS THE INPUT DID OF THE INPUT AREA
+	hmo->peekSection = sectionOfMeta(hmo, hmMetaPtr);
+	struct HMLibSpan span = hmo->spans[hmo->peekSection];
+	char* outputPtr = hmo->outputStart + span.slot * hmo->outSize;
+	hmo->outputPtr = outputPtr;
+
+	batchCount = ((uint8_t*)metaPtr)[4];
+	if(batchCount > MAX_BATCH_SIZE){
+		printLock.lock();
+		std::cerr << "Thread Receiver: " << hmo->HMLibID << " --- Invalid batch count: " << batchCount << "\n";
+		printLock.unlock();
+		return -2;
+	}
 	memcpy(inputLengths,metaPtr+12,sizeof(unsigned int)*batchCount);
 	memcpy(outputLengths,metaPtr+28,sizeof(unsigned int)*batchCount);	
 	memcpy(&tl,metaPtr+44,sizeof(uint64_t));
@@ -542,16 +1491,22 @@ int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MA
 	#ifdef HW_SIM
 		std::this_thread::sleep_for(std::chrono::microseconds(2));
 	#endif	
-	memcpy(outBuffer[0], metaPtr, hmo->metaSize);
-
+	//SPLIT THE SLOT BACK INTO ONE OUTPUT PER BATCHED INPUT, EACH ONE STARTS ON A 64 BYTE LINE
+	//THE POINTERS STAY VALID UNTIL releaseOutput HANDS THE SLOT BACK TO THE KERNEL
 	unsigned int totalOutSize = 0;
+	for(uint16_t i = batchCount; i < MAX_BATCH_SIZE; i++){
+		outPtr[i] = nullptr;
+		outSizes[i] = 0;
+	}
 	for(uint16_t i = 0; i < batchCount; i++){
-		outSizes[i] = outputLengths[i];
-		if(i == 0){
-			memcpy(outBuffer[i]+hmo->metaSize, outputPtr+totalOutSize, outputLengths[i]);
-		}else{
-			memcpy(outBuffer[i], outputPtr+totalOutSize, outputLengths[i]);
+		if(totalOutSize + outputLengths[i] > span.span * hmo->outSize){
+			printLock.lock();
+			std::cerr << "Thread Receiver: " << hmo->HMLibID << " --- Output " << i << " does not fit in the output section: " << outputLengths[i] << "\n";
+			printLock.unlock();
+			return -2;
 		}
+		outPtr[i] = outputPtr+totalOutSize;
+		outSizes[i] = outputLengths[i];
 		totalOutSize += outputLengths[i];
 		totalOutSize = customRound(totalOutSize,64);
 		if(stevez_debug){
@@ -578,13 +1533,6 @@ int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MA
 			std::cout << "\n";
 		}
 	}
-	
-
-	((unsigned int *)hmMetaPtr)[13] = 0;
-	//*((unsigned int *)(outputPtr+hmo->outSize-hmo->metaSize)) = 0;*/
-	(*(hmo->full))--;
-
-	//uint64_t receiveTimePoint = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 
 	hmo->latencies += receiveTimePoint - tl;
 	hmo->threadProcessed++;
@@ -592,22 +1540,351 @@ int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MA
 		hmo->prefetchHelp++;
 	}
 
-	hmo->outputMetaPtr += hmo->metaSize;
-	hmo->outputPtr += hmo->outSize;
-	if(hmo->outputMetaPtr == hmo->metaEnd){
-		hmo->outputMetaPtr = hmo->metaStart;
-		hmo->outputPtr = hmo->outputStart;
+	hmo->outputPeeked = true;
+	hmo->peekStart = std::chrono::duration_cast<std::chrono::nanoseconds>(t1.time_since_epoch()).count();
+	return 0;
+}
+
+int HMLib::releaseOutput(struct HMLibUniqueHandler* hmo){
+	if(!didInitialize){
+		printLock.lock();
+		std::cerr << "HMLib Object not initialized! Initialize before calling releaseOutput." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+	if(!hmo->outputPeeked){
+		printLock.lock();
+		std::cerr << "Thread Receiver: " << hmo->HMLibID << " --- No output peeked. Call peekOutput first." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	unsigned int section = hmo->peekSection;
+	char* hmMetaPtr = metaOfSection(hmo, section);
+	((unsigned int *)hmMetaPtr)[13] = 0;
+	//*((unsigned int *)(outputPtr+hmo->outSize-hmo->metaSize)) = 0;*/
+
+	//outputMetaPtr STAYS ON THE OLDEST SECTION NOT YET RELEASED. IT MOVES PAST THIS ONE AND EVERY LATER ONE ALREADY RELEASED
+	//OUT OF ORDER BEFORE THIS SECTION IS HANDED BACK, SO THE SENDER CANNOT REUSE A SECTION IT STILL HAS TO STEP OVER.
+	//A SECTION NOT SENT YET STILL HOLDS THE PROGRAM COUNTER OF THE LAST LAP AND STOPS IT
+	if(hmMetaPtr == hmo->outputMetaPtr){
+		do{
+			hmo->outputMetaPtr += hmo->metaSize;
+			if(hmo->outputMetaPtr == hmo->metaEnd){
+				hmo->outputMetaPtr = hmo->metaStart;
+			}
+			hmo->outputProgramCounter++;
+		}while(((volatile unsigned int*)hmo->outputMetaPtr)[14] == hmo->outputProgramCounter &&
+			!testBit(hmo->inFlightBits, (hmo->outputMetaPtr - hmo->metaStart)/hmo->metaSize));
 	}
 
-	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
-	std::chrono::duration<double> duration = t2 - t1;
-	hmo->copyTimeOut += std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	struct HMLibSpan span = hmo->spans[section];
+	setBits(hmo->slotBits, span.slot, span.span, false);
+	setBits(hmo->inFlightBits, section, 1, false);
+	(*(hmo->full)) -= span.span;
+	if(hmo->sendNeed->load() != 0 && waitPolicy == HMLIB_WAIT_SPIN_PARK){
+		syscall(SYS_futex, (int*)hmo->full, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+	}
+
+	hmo->outputPeeked = false;
+	uint64_t t2 = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	hmo->copyTimeOut += t2 - hmo->peekStart;
+
+	return 0;
+}
+
+int HMLib::checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	return checkOutputFrom(false, outBuffer, outSizes, batchProcessed, timeoutNS, hmo);
+}
+
+int HMLib::checkAnyOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	return checkOutputFrom(true, outBuffer, outSizes, batchProcessed, timeoutNS, hmo);
+}
+
+int HMLib::checkOutputFrom(const bool anyOrder, char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo){
+	char* outPtr[MAX_BATCH_SIZE];
+	unsigned int batchCount = 0;
+	int ec = peekOutputFrom(anyOrder, outPtr, outSizes, batchCount, timeoutNS, hmo);
+	if(ec != 0){
+		return ec;
+	}
+
+	//Copy the result to new buffer, the meta line in outBuffer[0] carries the program counter
+	memcpy(outBuffer[0], hmo->outputMeta, hmo->metaSize);
+	for(unsigned int i = 0; i < batchCount; i++){
+		if(i == 0){
+			memcpy(outBuffer[i]+hmo->metaSize, outPtr[i], outSizes[i]);
+		}else{
+			memcpy(outBuffer[i], outPtr[i], outSizes[i]);
+		}
+	}
+
+	ec = releaseOutput(hmo);
+	if(ec != 0){
+		return ec;
+	}
 
 	batchProcessed += batchCount;
 	return 0;
 
 }
 
+bool HMLib::startAsync(){
+	if(!didInitialize){
+		std::cerr << "HMLib Object not initialized! Initialize before calling startAsync." << "\n";
+		return false;
+	}
+	if(asyncRunning){
+		return true;
+	}
+	for(unsigned int i = 0; i < activeHandlers; i++){
+		asyncHandlers[i].hmo = getHMLibUniqueHandler(i);
+		if(asyncHandlers[i].hmo == nullptr){
+			for(unsigned int j = 0; j < i; j++){
+				returnHMLibUniqueHandler(asyncHandlers[j].hmo, j);
+				asyncHandlers[j].hmo = nullptr;
+			}
+			return false;
+		}
+		asyncHandlers[i].inFlight = 0;
+	}
+
+	asyncRunning = true;
+	asyncNext = 0;
+	for(unsigned int i = 0; i < activeHandlers; i++){
+		asyncHandlers[i].completion = std::thread(&HMLib::completionTask, this, &asyncHandlers[i]);
+	}
+	return true;
+}
+
+bool HMLib::stopAsync(){
+	if(!asyncRunning){
+		return false;
+	}
+	//COMPLETION THREADS DRAIN WHAT IS STILL IN FLIGHT BEFORE THEY EXIT
+	asyncRunning = false;
+	bool pass = true;
+	for(unsigned int i = 0; i < activeHandlers; i++){
+		asyncHandlers[i].completion.join();
+		pass &= returnHMLibUniqueHandler(asyncHandlers[i].hmo, i);
+		asyncHandlers[i].hmo = nullptr;
+	}
+	return pass;
+}
+
+void HMLib::completionTask(struct HMLibAsyncHandler* handler){
+	struct HMLibUniqueHandler* hmo = handler->hmo;
+	char* outPtr[MAX_BATCH_SIZE];
+	unsigned int outSizes[MAX_BATCH_SIZE];
+	unsigned int batchCount;
+
+	while(asyncRunning || handler->inFlight.load() != 0){
+		//SHORT TIMEOUT SO AN IDLE THREAD STILL SEES stopAsync. RESULTS ARE MATCHED BY PROGRAM COUNTER, SO TAKE WHICHEVER IS DONE
+		int ec = peekAnyOutput(outPtr, outSizes, batchCount, 1000000, hmo);
+		if(ec == -1){
+			continue;
+		}
+
+		HMLibResult result;
+		result.status = ec;
+		result.code = ((uint16_t*)hmo->outputMeta)[1];
+		result.programCounter = ((unsigned int*)hmo->outputMeta)[15];
+		if(ec == 0){
+			for(unsigned int i = 0; i < batchCount; i++){
+				result.data.insert(result.data.end(), outPtr[i], outPtr[i] + outSizes[i]);
+			}
+		}else{
+			//A BAD META LINE STILL FREES ITS SLOT, OTHERWISE THE RING STALLS ON IT
+			hmo->outputPeeked = true;
+		}
+		ec = releaseOutput(hmo);
+		if(result.status == 0){
+			result.status = ec;
+		}
+
+		HMLibPending request;
+		bool found = false;
+		handler->pendingLock.lock();
+		std::unordered_map<unsigned int, HMLibPending>::iterator it = handler->pending.find(result.programCounter);
+		if(it != handler->pending.end()){
+			request = std::move(it->second);
+			handler->pending.erase(it);
+			found = true;
+		}
+		handler->pendingLock.unlock();
+
+		if(!found){
+			printLock.lock();
+			std::cerr << "Thread Receiver: " << hmo->HMLibID << " --- No request waiting for program counter: " << result.programCounter << "\n";
+			printLock.unlock();
+			continue;
+		}
+		handler->inFlight--;
+		if(request.callback){
+			request.callback(result);
+		}else{
+			request.promise.set_value(std::move(result));
+		}
+	}
+}
+
+int HMLib::submitPending(const char* input, const unsigned int size, const uint16_t code, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity, HMLibPending& request){
+	if(!asyncRunning){
+		printLock.lock();
+		std::cerr << "HMLib async API not started! Call startAsync before calling submit." << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	//A STREAM WITH AN AFFINITY STAYS ON ONE HANDLER AS WELL AS ON ONE OF ITS PEs
+	struct HMLibAsyncHandler* handler = &asyncHandlers[(affinity != 0) ? affinity % activeHandlers : asyncNext++ % activeHandlers];
+	struct HMLibUniqueHandler* hmo = handler->hmo;
+
+	std::lock_guard<std::mutex> sendGuard(handler->sendLock);
+	if(size == 0){
+		printLock.lock();
+		std::cerr << "Input " << hmo->HMLibID << ": --- Input length is too long: " << size << "\n";
+		printLock.unlock();
+		return -2;
+	}
+
+	char* slot;
+	unsigned int slotSize;
+	int ec = reserveInputSlot(slot, slotSize, 0, hmo, size, priority);
+	if(ec != 0){
+		return ec;
+	}
+	copyToRing(slot, input, size);
+
+	//REGISTER BEFORE THE KERNEL CAN SEE THE SLOT, commitInput TAGS IT WITH THE NEXT PROGRAM COUNTER OF ITS RING
+	unsigned int programCounter = ((priority == HMLIB_PRIORITY_HIGH) ? hmo->priorityProgramCounter : hmo->programCounter) + 1;
+	handler->pendingLock.lock();
+	handler->pending[programCounter] = std::move(request);
+	handler->pendingLock.unlock();
+	handler->inFlight++;
+
+	unsigned int sizes[MAX_BATCH_SIZE] = {size, 0, 0, 0};
+	ec = commitInput(sizes, 1, code, hmo, argument, operand, affinity);
+	if(ec != 0){
+		handler->pendingLock.lock();
+		request = std::move(handler->pending[programCounter]);
+		handler->pending.erase(programCounter);
+		handler->pendingLock.unlock();
+		handler->inFlight--;
+	}
+	return ec;
+}
+
+std::future<HMLibResult> HMLib::submit(const char* input, const unsigned int size, const uint16_t code, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity){
+	HMLibPending request;
+	std::future<HMLibResult> result = request.promise.get_future();
+	int ec = submitPending(input, size, code, priority, argument, operand, affinity, request);
+	if(ec != 0){
+		HMLibResult failed;
+		failed.status = ec;
+		failed.code = code;
+		failed.programCounter = 0;
+		request.promise.set_value(std::move(failed));
+	}
+	return result;
+}
+
+int HMLib::submit(const char* input, const unsigned int size, const uint16_t code, HMLibCallback callback, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity){
+	HMLibPending request;
+	request.callback = callback;
+	return submitPending(input, size, code, priority, argument, operand, affinity, request);
+}
+
+bool HMLib::startReactor(){
+	if(!didInitialize){
+		std::cerr << "HMLib Object not initialized! Initialize before calling startReactor." << "\n";
+		return false;
+	}
+	if(!reactorRunning){
+		reactorLock.lock();
+		reactorRunning = true;
+		reactorLock.unlock();
+		reactor = std::thread(&HMLib::reactorTask, this);
+	}
+	return true;
+}
+
+//reactorRunning ONLY CHANGES UNDER reactorLock, SO A WAITER IS EITHER REGISTERED BEFORE THE REACTOR'S LAST DRAIN OR REFUSED
+void HMLib::stopReactor(){
+	reactorLock.lock();
+	bool running = reactorRunning;
+	reactorRunning = false;
+	reactorLock.unlock();
+	if(running){
+		reactor.join();
+	}
+}
+
+bool HMLib::whenOutputReady(struct HMLibUniqueHandler* hmo, std::function<void()> resume){
+	if(hmo == nullptr){
+		printLock.lock();
+		std::cerr << "HMLibUniqueHandler passed is not initialized. Call getHMLibUniqueHandler." << "\n";
+		printLock.unlock();
+		return false;
+	}
+	//NOT AN ERROR WHEN THE REACTOR IS STOPPED: resume IS NOT REGISTERED AND THE CALLER WAITS IN peekOutput ITSELF
+	reactorLock.lock();
+	bool running = reactorRunning;
+	if(running){
+		reactorWaiters.emplace_back(hmo, std::move(resume));
+	}
+	reactorLock.unlock();
+	return running;
+}
+
+void HMLib::reactorTask(){
+	std::vector<std::pair<struct HMLibUniqueHandler*, std::function<void()>>> waiting;
+	std::vector<std::function<void()>> ready;
+	HMLibWaiter idle(waitPolicy, 0);
+
+	while(true){
+		reactorLock.lock();
+		for(unsigned int i = 0; i < reactorWaiters.size(); i++){
+			waiting.push_back(std::move(reactorWaiters[i]));
+		}
+		reactorWaiters.clear();
+		bool finished = waiting.empty() && !reactorRunning;
+		reactorLock.unlock();
+
+		if(finished){
+			break;
+		}
+
+		//ONE PASS OVER THE META LINE EACH WAITER IS BLOCKED ON
+		for(unsigned int i = 0; i < waiting.size();){
+			if(((volatile unsigned int*)waiting[i].first->outputMetaPtr)[13] == 2){
+				ready.push_back(std::move(waiting[i].second));
+				waiting[i] = std::move(waiting.back());
+				waiting.pop_back();
+			}else{
+				i++;
+			}
+		}
+
+		if(ready.empty()){
+			idle.pause(nullptr, 0);
+			continue;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		for(unsigned int i = 0; i < ready.size(); i++){
+			ready[i]();
+		}
+		ready.clear();
+		idle = HMLibWaiter(waitPolicy, 0);
+	}
+}
+
 bool HMLib::checkMemoryValue(char* memory, const unsigned int programCounter, const uint16_t code){
 	bool correctSignal = false;
 
@@ -672,6 +1949,10 @@ bool HMLib::stopKernel(){
 		std::cerr << "HMLib Object not initialized! Initialize before calling stopKernel." << "\n";
 		return false;
 	}
+	if(!kernelRunning){
+		std::cerr << "Kernel already stopped" << "\n";
+		return false;
+	}
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		if(hmStatesTracker[i]){
 			std::cerr << "Call returnHMLibUniqueHandler first for ID: " << hostMemStates[i].HMLibID << "\n";
@@ -681,51 +1962,58 @@ bool HMLib::stopKernel(){
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		unsigned int sectionMetaSend = hostMemStates[i].bufferSections - (hostMemStates[i].metaEnd - hostMemStates[i].inputMetaPtr)/hostMemStates[i].metaSize;
 		unsigned int sectionMetaRecv = hostMemStates[i].bufferSections - (hostMemStates[i].metaEnd - hostMemStates[i].outputMetaPtr)/hostMemStates[i].metaSize;
-		if(sectionMetaSend != sectionMetaRecv){
+		bool priorityInFlight = false;
+		for(unsigned int k = 0; k < HMLIB_PRIORITY_SECTIONS; k++){
+			priorityInFlight |= testBit(hostMemStates[i].inFlightBits, hostMemStates[i].bufferSections + k);
+		}
+		if(sectionMetaSend != sectionMetaRecv || priorityInFlight){
 			std::cerr << "Results not retrieved for handler: " << hostMemStates[i].HMLibID << "\n";
 			return false;
 		}
 	}
 
 	uint16_t code = 1;
-	bool correctSignal;
+	bool correctSignal = true;
+	char* exitMeta[HMLIB_HANDLERS];
 
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-		for(unsigned int j = 0; j < /*PE_PER_HANDLER*/1; j++){
-			unsigned int currentPE = hostMemStates[i].programCounter % 1;//PE_PER_HANDLER;
+		//EVERY USER PE OF THE HANDLER TAKES ITS OWN EXIT CODE, THE KERNEL HANDS THEM OUT ROUND ROBIN
+		for(unsigned int j = 0; j < HMLIB_PE_PER_HANDLER; j++){
+			unsigned int currentPE = hostMemStates[i].programCounter % HMLIB_PE_PER_HANDLER;
 			char* metaPtr = hostMemStates[i].inputMetaPtr;
 			std::cout << "HMLib " << hostMemStates[i].HMLibID << " " << currentPE << " --- Write exit" << "\n";
 		
 			hostMemStates[i].programCounter++;
 
 			((uint16_t*)metaPtr)[0] = code;
+			((uint16_t*)metaPtr)[1] = 0;
 			((uint16_t*)metaPtr)[2] = 0;
+			((uint16_t*)metaPtr)[3] = 0;
 			((uint32_t*)metaPtr)[2] = 0;
 			((uint32_t*)metaPtr)[3] = 0;
 			((uint32_t*)metaPtr)[4] = 0;
 			((uint32_t*)metaPtr)[5] = 0;
 			((uint32_t*)metaPtr)[6] = 0;
 			
+			//ALSO CLEARS THE DATA SLOT WORD, THE EXIT REQUEST CARRIES NO DATA
 			for(unsigned int i = 0; i < 4; i++){
 				((uint32_t*)metaPtr)[7+i] = 0;
 			}
 			((unsigned int*)metaPtr)[14] = hostMemStates[i].programCounter;
+			ringDoorbell(&hostMemStates[i]);
 
-			bool correctSignal = checkMemoryValue(hostMemStates[i].outputMetaPtr, hostMemStates[i].programCounter, code);
+			exitMeta[i] = hostMemStates[i].outputMetaPtr;
+			correctSignal = checkMemoryValue(hostMemStates[i].outputMetaPtr, hostMemStates[i].programCounter, code);
 
 			((unsigned int*)metaPtr)[13] = 0;
-			memset(hostMemStates[i].outputPtr, 0, hostMemStates[i].metaSize);
 
 			hostMemStates[i].inputMetaPtr += hostMemStates[i].metaSize;
 			hostMemStates[i].outputMetaPtr += hostMemStates[i].metaSize;
-			hostMemStates[i].inputPtr += hostMemStates[i].inputSize;
-			hostMemStates[i].outputPtr += hostMemStates[i].outSize;
+			hostMemStates[i].outputProgramCounter++;
 
 			if(hostMemStates[i].inputMetaPtr == hostMemStates[i].metaEnd){
 				hostMemStates[i].inputMetaPtr = hostMemStates[i].metaStart;
 				hostMemStates[i].outputMetaPtr = hostMemStates[i].metaStart;
-				hostMemStates[i].inputPtr = hostMemStates[i].inputStart;
-				hostMemStates[i].outputPtr = hostMemStates[i].outputStart;
 			}
 
 			if(!correctSignal){
@@ -733,12 +2021,18 @@ bool HMLib::stopKernel(){
 			}
 		}
 	}
+	kernelRunning = false;
 
-	std::this_thread::sleep_for(std::chrono::seconds(3));
+	//THE SOFTWARE DEVICE KEEPS NO WRITE STATISTICS
+	if(softwareDevice != nullptr){
+		std::cout << "Exit completed" << "\n";
+		return correctSignal;
+	}
 
+	//memoryHandlerWrite HOLDS THE EXIT ACKNOWLEDGEMENT BACK AND WRITES IT LAST WITH ITS STATISTICS IN BITS 128-319
 	std::cout << "Exit completed" << "\n";
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-		std::cout << "HMLib " << hostMemStates[i].HMLibID << " DATA FULL/PARTIAL WRITES: " << ((uint64_t*)hostMemStates[i].metaStart)[0] << " " << ((uint64_t*)hostMemStates[i].metaStart)[1] << " " << ((uint64_t*)hostMemStates[i].metaStart)[2] << "\n";
+		std::cout << "HMLib " << hostMemStates[i].HMLibID << " DATA FULL/PARTIAL WRITES: " << ((uint64_t*)exitMeta[i])[2] << " " << ((uint64_t*)exitMeta[i])[3] << " " << ((uint64_t*)exitMeta[i])[4] << "\n";
 	}
 	return correctSignal;
 }
@@ -774,6 +2068,13 @@ void HMLib::printStatistics(double& overallTime){
 			std::cout << hostMemStates[i].totalSize/hostMemStates[i].threadProcessed << "\n";
 		}
 	}
+	#if HMLIB_COMPRESS
+		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+			if(hostMemStates[i].unpackedSize != 0){
+				std::cout << "Thread Receiver: " << i << " --- LZ4 packed inputs (bytes): " << hostMemStates[i].unpackedSize << " -> " << hostMemStates[i].packedSize << "\n";
+			}
+		}
+	#endif
 	std::cout << "\n";
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		if(hostMemStates[i].threadProcessed != 0){
@@ -795,12 +2096,17 @@ void HMLib::printStatistics(double& overallTime){
 			break;
 		}
 	}
+	//Handlers run concurrently, the end to end time is the slowest handler
+	uint64_t aggregateSize = 0;
+	uint64_t aggregateTime = 0;
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		if(hostMemStates[i].threadProcessed != 0){
+			aggregateSize += hostMemStates[i].totalSize;
+			aggregateTime = std::max(aggregateTime, hostMemStates[i].overallTime);
 			#ifdef HW_SIM
-				overallTime =  (double)hostMemStates[i].overallTime/pow(1000.0,3);
+				overallTime =  (double)aggregateTime/pow(1000.0,3);
 			#else
-				overallTime =  (double)hostMemStates[i].overallTime/pow(1000.0,1);
+				overallTime =  (double)aggregateTime/pow(1000.0,1);
 			#endif
 			// overallTime =  (double)hostMemStates[i].overallTime/pow(1000.0,3);
 			std::cout << "Thread Receiver: " << i << " --- Statistics: ";
@@ -820,6 +2126,9 @@ void HMLib::printStatistics(double& overallTime){
 			#endif
 		}
 	}
+	if(aggregateTime != 0){
+		std::cout << "All Handlers: --- Throughput (GB/s): " << ((double)aggregateSize/pow(1024,3))/((double)aggregateTime/pow(1000.0,3)) << "\n";
+	}
 	std::cout << "\n";
 	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
 		if(hostMemStates[i].threadProcessed != 0){
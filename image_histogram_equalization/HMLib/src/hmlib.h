@@ -14,18 +14,62 @@
 #include <time.h>
 #include <deque>
 #include <thread>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
 
+//THE SOFTWARE BACKEND BUILDS WITHOUT XRT, EVERY OpenCL PATH BELOW IS COMPILED OUT WITH HMLIB_SOFTWARE
+#ifndef HMLIB_SOFTWARE
 #include "CL/cl_ext_xilinx.h"
 #include "xcl2.hpp"
 #include "experimental/xclbin_util.h"
 #include <uuid/uuid.h>
 #include <xclhal2.h>
+#endif
 #include <x86intrin.h>
 #include <emmintrin.h>
 
 #include "helpers.h"
 
 #define MAX_BATCH_SIZE 4
+//PINNED POOL SIZE CLASSES: POWERS OF TWO FROM HMLIB_PINNED_MIN_BYTES UP
+#define HMLIB_PINNED_MIN_BYTES 64
+#define HMLIB_PINNED_CLASSES 32
+
+//HOW reserveInputSlot/peekOutput WAIT FOR A FREE SLOT OR A RESULT. SPIN_YIELD AND SPIN_PARK SPIN FOR
+//HMLIB_SPIN_NS FIRST, SPIN_PARK THEN SLEEPS WITH A BACKOFF DOUBLING FROM HMLIB_PARK_MIN_NS TO HMLIB_PARK_MAX_NS
+//-DHMLIB_WAIT_POLICY=0/1/2 PICKS THE DEFAULT, setWaitPolicy() CHANGES IT AT RUNTIME
+enum HMLibWaitPolicy{
+	HMLIB_WAIT_SPIN = 0,
+	HMLIB_WAIT_SPIN_YIELD = 1,
+	HMLIB_WAIT_SPIN_PARK = 2
+};
+#ifndef HMLIB_WAIT_POLICY
+#define HMLIB_WAIT_POLICY HMLIB_WAIT_SPIN_PARK
+#endif
+#define HMLIB_SPIN_NS 20000
+#define HMLIB_PARK_MIN_NS 1000
+#define HMLIB_PARK_MAX_NS 100000
+
+//HOW PAYLOAD AND META LINES ARE WRITTEN INTO THE RING. THE BEST ONE IS PICKED FROM CPUID
+enum HMLibCopyEngine{
+	HMLIB_COPY_MEMCPY = 0,
+	HMLIB_COPY_AVX2 = 1,
+	HMLIB_COPY_AVX512 = 2
+};
+
+//WHICH META RING A REQUEST GOES THROUGH. HIGH NEEDS A BUILD WITH HMLIB_PRIORITY_SECTIONS
+enum HMLibPriority{
+	HMLIB_PRIORITY_NORMAL = 0,
+	HMLIB_PRIORITY_HIGH = 1
+};
+
+//WHERE THE DATA OF ONE META SECTION LIVES: ITS FIRST SLOT AND HOW MANY CONTIGUOUS SLOTS IT SPANS
+struct HMLibSpan{
+	unsigned int slot;
+	unsigned int span;
+};
 
 struct HMLibUniqueHandler{
 	//64
@@ -42,7 +86,9 @@ struct HMLibUniqueHandler{
 	char* outputStart;
 
 	char* outputEnd;
-	char pad1[56];
+	//LINE AFTER THE META SECTIONS HOLDING THE NEWEST PROGRAM COUNTER PUBLISHED TO THE KERNEL
+	char* doorbell;
+	char pad1[48];
 
 	//64 bytes
 	char* inputMetaPtr;
@@ -52,7 +98,10 @@ struct HMLibUniqueHandler{
 	uint64_t timeWaitSend;
 	uint64_t copyTimeIn;
 	uint64_t oneSendTime;
-	char pad2[20];
+	//BYTES commitInput WROTE TO THE RING FOR THE INPUTS IT SENT AS LZ4 BLOCKS, AGAINST THE LINES THEY EXPAND TO
+	uint64_t packedSize;
+	uint64_t unpackedSize;
+	char pad2[4];
 
 	//64
 	char* outputMetaPtr;
@@ -62,52 +111,272 @@ struct HMLibUniqueHandler{
 	uint64_t prefetchHelp;
 	uint64_t computeLatency;
 	uint64_t threadProcessed;
-	char pad3[8];
+	//SEND PROGRAM COUNTER OF THE REQUEST AT outputMetaPtr, THE OLDEST ONE NOT YET RELEASED
+	unsigned int outputProgramCounter;
+	char pad3[4];
 
 	//64
 	uint64_t oneReadTime;
 	uint64_t overallTime;
 	uint64_t timeWaitRead;
-	char pad[40];
+	uint64_t reserveStart;
+	uint64_t peekStart;
+	bool inputReserved;
+	bool outputPeeked;
+	unsigned int reserveSpan;
+	unsigned int reserveSlot;
+	unsigned int peekSection;
+	char pad[10];
 
+	//64 copy of the meta line of the output returned by peekOutput
+	char outputMeta[64];
+
+	//SLOTS IN USE, releaseOutput CHANGES IT ON EVERY RELEASE SO IT DOUBLES AS THE WORD A PARKED SENDER SLEEPS ON
 	std::atomic<unsigned int>* full;
+	//SLOTS A PARKED SENDER WAITS FOR, 0 WHEN NO SENDER IS PARKED
+	std::atomic<unsigned int>* sendNeed;
+	//ONE ENTRY PER META SECTION, WRITTEN BY commitInput AND READ BACK BY peekOutput/releaseOutput
+	struct HMLibSpan* spans;
+	//ONE BIT PER DATA SLOT IN USE. SET BY commitInput, CLEARED BY releaseOutput IN ANY ORDER
+	std::atomic<uint64_t>* slotBits;
+	//ONE BIT PER META SECTION FROM commitInput UNTIL releaseOutput. peekAnyOutput SCANS THESE FOR STATUS 2
+	std::atomic<uint64_t>* inFlightBits;
+	//commitInput COMPRESSES A REQUEST HERE BEFORE COPYING IT BACK INTO ITS SLOT (HMLIB_COMPRESS ONLY)
+	char* packBuffer;
+
+	//HIGH PRIORITY RING: HMLIB_PRIORITY_SECTIONS META LINES AFTER THE DOORBELL BURST, NUMBERED FROM bufferSections ON
+	//IN spans AND inFlightBits. IT SHARES THE DATA SLOTS WITH THE NORMAL RING AND IS ONLY READ BACK BY peekAnyOutput
+	char* priorityStart;
+	char* priorityEnd;
+	char* priorityMetaPtr;
+	unsigned int priorityProgramCounter;
+	//RING OF THE SLOT reserveInputSlot HANDED OUT
+	HMLibPriority reservePriority;
+	//DESCRIPTORS IN THE RESERVED SLOT WHEN sendInputGather SENDS BY REFERENCE, 0 WHEN THE INPUTS ARE IN THE SLOT
+	unsigned int reserveDescriptors;
+};
+
+//PINNED HOST MEMORY registerBuffer HANDED OUT. THE KERNEL REACHES IT AS A LINE OFFSET FROM ITS RING
+//A REGION (registerRegion) IS CARVED INTO POOLED SUB-BUFFERS FROM ITS START, carved BYTES ARE HANDED OUT SO FAR
+struct HMLibRegisteredBuffer{
+	#ifndef HMLIB_SOFTWARE
+	cl::Buffer buffer;
+	#endif
+	char* host;
+	size_t bytes;
+	uint64_t deviceAddress;
+	bool region;
+	size_t carved;
+};
+
+//A HOST-SIDE STAND-IN FOR THE memAccelerate KERNEL THAT SERVES THE RINGS WITH THE SAME PROTOCOL, SEE hmlib_sw.h
+class HMLibDevice{
+	public:
+		virtual ~HMLibDevice(){}
+		//START SERVING ONE HANDLER'S RING. CALLED FOR EVERY HANDLER, ACTIVE OR NOT, ONCE THE RING IS CLEARED
+		virtual bool start(const unsigned int handler, char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize) = 0;
+		//WAIT UNTIL EVERY RING HAS SEEN ITS EXIT CODE
+		virtual void finish() = 0;
+		virtual std::string name() = 0;
+};
+
+//ONE FINISHED submit(). status IS 0 ON SUCCESS, OTHERWISE THE ERROR CODE OF THE CALL THAT FAILED
+struct HMLibResult{
+	int status;
+	uint16_t code;
+	unsigned int programCounter;
+	std::vector<char> data;
+};
+typedef std::function<void(HMLibResult&)> HMLibCallback;
+
+//A submit() THAT IS IN THE RING. EXACTLY ONE OF promise OR callback IS USED
+struct HMLibPending{
+	std::promise<HMLibResult> promise;
+	HMLibCallback callback;
+};
+
+//STATE OF ONE HANDLER DRIVEN BY THE ASYNC API. submit() CALLERS SHARE THE SEND SIDE UNDER sendLock,
+//THE COMPLETION THREAD OWNS THE RECEIVE SIDE AND FULFILS pending BY PROGRAM COUNTER
+struct HMLibAsyncHandler{
+	struct HMLibUniqueHandler* hmo;
+	std::mutex sendLock;
+	std::mutex pendingLock;
+	std::unordered_map<unsigned int, HMLibPending> pending;
+	std::atomic<unsigned int> inFlight;
+	std::thread completion;
 };
 
 class HMLib{
 	private:
 		std::mutex printLock;
 		
+		#ifndef HMLIB_SOFTWARE
 		cl::CommandQueue q;
 		cl::Device device;
 		cl::Context context;
 		cl::Kernel HMLibKernel;
-		cl::Kernel userKernel;
+		cl::Kernel userKernel[HMLIB_USER_PES];
 
 		cl::Buffer HMLibKernelMemory[HMLIB_HANDLERS];
+		#endif
 
 		struct HMLibUniqueHandler hostMemStates[HMLIB_HANDLERS];
 
 		bool didInitialize;
+		bool kernelRunning;
+		unsigned int activeHandlers;
 
 		char* HMLibMappedMem[HMLIB_HANDLERS];
+		//BYTES ALLOCATED FOR EACH RING, reconfigure ONLY REALLOCATES A RING THAT GROWS PAST IT
+		size_t ringCapacity[HMLIB_HANDLERS];
+		//WHERE THE KERNEL SEES EACH RING, DESCRIPTOR OFFSETS ARE TAKEN FROM HERE
+		uint64_t ringDeviceAddress[HMLIB_HANDLERS];
+
+		std::mutex registeredLock;
+		std::vector<struct HMLibRegisteredBuffer> registeredBuffers;
+		bool deviceAddressOf(const char* ptr, const unsigned int bytes, uint64_t& address);
+		//FREED SUB-BUFFERS BY SIZE CLASS AND THE SIZE CLASS OF EVERY SUB-BUFFER HANDED OUT, UNDER registeredLock
+		std::vector<char*> pinnedFree[HMLIB_PINNED_CLASSES];
+		std::unordered_map<char*, unsigned int> pinnedInUse;
 
 		bool hmStatesTracker[HMLIB_HANDLERS];
+
+		//nullptr WHEN THE RINGS ARE SERVED BY THE FPGA
+		HMLibDevice* softwareDevice;
+		void sizeRings(const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers);
+		void setupRing(const unsigned int i);
+		void releaseRing(const unsigned int i);
+		bool mapRing(const unsigned int i);
+		bool startKernel();
+		int peekOutputFrom(const bool anyOrder, char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		int checkOutputFrom(const bool anyOrder, char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+
+		HMLibCopyEngine copyEngine;
+		HMLibWaitPolicy waitPolicy;
+		void copyToRing(char* dst, const char* src, const unsigned int size);
+		void publishMeta(char* dst, const char* line);
+		void ringDoorbell(struct HMLibUniqueHandler* hmo);
+
+		struct HMLibAsyncHandler asyncHandlers[HMLIB_HANDLERS];
+		std::atomic<bool> asyncRunning;
+		std::atomic<unsigned int> asyncNext;
+		void completionTask(struct HMLibAsyncHandler* handler);
+		int submitPending(const char* input, const unsigned int size, const uint16_t code, const HMLibPriority priority, const uint32_t argument, const uint64_t operand, const uint8_t affinity, HMLibPending& request);
+
+		std::mutex reactorLock;
+		std::vector<std::pair<struct HMLibUniqueHandler*, std::function<void()>>> reactorWaiters;
+		std::atomic<bool> reactorRunning;
+		std::thread reactor;
+		void reactorTask();
 	public:
 		HMLib();
 		~HMLib();
-		bool initialize(const std::string binaryFile, const std::string kernelName, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize);
+		//FAILS IN AN HMLIB_SOFTWARE BUILD, WHICH HAS NO OpenCL RUNTIME TO PROGRAM A DEVICE WITH
+		bool initialize(const std::string binaryFile, const std::string kernelName, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers = HMLIB_HANDLERS);
+		//SOFTWARE BACKEND: NO XCLBIN, device SERVES THE RINGS IN PLAIN HOST MEMORY. HMLib DOES NOT OWN device
+		bool initialize(HMLibDevice* device, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers = HMLIB_HANDLERS);
+		//KEEPS THE PROGRAMMED DEVICE AND RE-CARVES THE RINGS FOR A NEW SLOT SIZE. EVERY HANDLER MUST BE RETURNED AND DRAINED,
+		//ASYNC AND REACTOR STOPPED. STOPS THE KERNEL IF STILL RUNNING, THEN STARTS IT AGAIN ON THE NEW RINGS
+		bool reconfigure(const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outputSize, const unsigned int handlers = HMLIB_HANDLERS);
+		unsigned int getActiveHandlers();
+		HMLibCopyEngine getCopyEngine();
+		bool setCopyEngine(const HMLibCopyEngine engine);
+		HMLibWaitPolicy getWaitPolicy();
+		void setWaitPolicy(const HMLibWaitPolicy policy);
 
 		struct HMLibUniqueHandler* getHMLibUniqueHandler(unsigned int HMid);
 		bool returnHMLibUniqueHandler(struct HMLibUniqueHandler* val, unsigned int HMid);
 
-		int sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		//ZERO-COPY SEND: reserveInputSlot RETURNS THE NEXT RING SLOT (slotSize BYTES) FOR THE CALLER TO FILL IN PLACE.
+		//BATCHED INPUTS GO BACK TO BACK, EACH ONE STARTING ON A 64 BYTE LINE. commitInput PUBLISHES THE SLOT TO THE KERNEL
+		//bytes LARGER THAN ONE SLOT RESERVES ENOUGH CONTIGUOUS SLOTS, THE OUTPUT GETS THE SAME NUMBER OF OUTPUT SLOTS.
+		//SLOTS ARE TAKEN FROM WHEREVER A LARGE ENOUGH FREE RUN IS, SO SLOTS RELEASED OUT OF ORDER ARE REUSED AT ONCE
+		//HMLIB_PRIORITY_HIGH SENDS THE REQUEST THROUGH THE HIGH PRIORITY RING, THE KERNEL PICKS IT UP AHEAD OF NORMAL ONES.
+		//argument REACHES THE PE UNTOUCHED IN BITS 224-255 OF THE CODE PACKET, NEXT TO THE CODE (A KEY ID, A MODE, ...),
+		//operand IN BITS 256-319 (AN IV, A COUNTER, ...). REQUESTS WITH THE SAME NONZERO affinity ALL GO TO PE affinity % PEs OF
+		//THE HANDLER, SO STATE A PE KEEPS BETWEEN THEM (A CHAIN, A RUNNING SUM) STAYS WITH THEM. 0 SPREADS THEM ROUND ROBIN
+		int reserveInputSlot(char*& slot, unsigned int& slotSize, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const unsigned int bytes = 0, const HMLibPriority priority = HMLIB_PRIORITY_NORMAL);
+		int commitInput(const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchCount, const uint16_t code, struct HMLibUniqueHandler* hmo, const uint32_t argument = 0, const uint64_t operand = 0, const uint8_t affinity = 0);
+		//ZERO-COPY RECEIVE: peekOutput POINTS outPtr AT EACH OUTPUT INSIDE THE RING SLOT, THE META LINE IS COPIED TO hmo->outputMeta.
+		//THE POINTERS ARE VALID UNTIL releaseOutput HANDS THE SLOT BACK TO THE KERNEL
+		int peekOutput(char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		//OUT OF ORDER RECEIVE: RETURNS WHICHEVER REQUEST IN FLIGHT IS DONE, OLDEST FIRST, SO A SMALL REQUEST IS NOT STUCK BEHIND
+		//A LARGE ONE ON ANOTHER PE. THE SEND PROGRAM COUNTER IN hmo->outputMeta (uint[14]) TELLS WHICH REQUEST IT WAS.
+		//HIGH PRIORITY REQUESTS ARE CHECKED FIRST AND ONLY COME BACK THROUGH THIS CALL
+		int peekAnyOutput(char* outPtr[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchCount, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		//HANDS BACK THE SLOTS OF THE OUTPUT LAST PEEKED, IN ORDER OR NOT
+		int releaseOutput(struct HMLibUniqueHandler* hmo);
+
+		//COPYING WRAPPERS AROUND THE CALLS ABOVE
+		int sendInput(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const HMLibPriority priority = HMLIB_PRIORITY_NORMAL, const uint32_t argument = 0, const uint64_t operand = 0, const uint8_t affinity = 0);
 		int checkOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		int checkAnyOutput(char* outBuffer[MAX_BATCH_SIZE], unsigned int outSizes[MAX_BATCH_SIZE], unsigned int& batchProcessed, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+		//CONTROL REQUEST FOR STATE KEPT IN THE PEs (KEYS, TABLES): SENDS input WITH code TO EVERY PE OF THE HANDLER AND WAITS FOR
+		//ALL OF THEIR OUTPUTS, WHICH ARE DROPPED. NOTHING MAY BE IN FLIGHT ON THE HANDLER OR BE SENT ON IT FROM ANOTHER THREAD MEANWHILE
+		int sendControl(const char* input, const unsigned int size, const uint16_t code, const uint32_t argument, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo);
+
+		//REGISTERED BUFFERS: PINNED HOST MEMORY THE KERNEL CAN READ INPUTS FROM IN PLACE. NOTHING SENT FROM A BUFFER MAY STILL
+		//BE IN FLIGHT WHEN IT IS UNREGISTERED, THE DESTRUCTOR FREES WHAT IS LEFT
+		char* registerBuffer(const size_t bytes);
+		bool unregisterBuffer(char* buffer);
+		//PINNED POOL: registerRegion MAPS ONE LARGE PINNED REGION UP FRONT, allocatePinned THEN HANDS OUT 64 BYTE ALIGNED
+		//SUB-BUFFERS FROM THE REGIONS WITHOUT A DEVICE CALL. SIZES ROUND UP TO A POWER OF TWO AND A FREED SUB-BUFFER IS KEPT FOR
+		//THE NEXT ONE OF ITS SIZE CLASS. SUB-BUFFERS ARE REGISTERED MEMORY. nullptr WHEN NO REGION HAS ROOM LEFT
+		bool registerRegion(const size_t bytes);
+		char* allocatePinned(const size_t bytes);
+		bool freePinned(char* buffer);
+		//SEND BY REFERENCE (HMLIB_GATHER): LIKE sendInput, BUT EVERY INPUT STARTS ON A 64 BYTE LINE OF A REGISTERED BUFFER. ONLY A
+		//DESCRIPTOR LINE GOES INTO THE SLOT AND THE KERNEL FETCHES THE INPUTS WHERE THEY ARE, SO THEY MUST NOT CHANGE UNTIL THE
+		//OUTPUT IS BACK. UP TO MAX_BATCH_SIZE INPUTS OF ANY SIZE ARE BATCHED, THE OUTPUT STILL TAKES AS MANY SLOTS AS THEY WOULD
+		int sendInputGather(const char* buffer[MAX_BATCH_SIZE], const unsigned int sizes[MAX_BATCH_SIZE], const unsigned int batchRequest, unsigned int& batched, const uint16_t code, const uint64_t timeoutNS, struct HMLibUniqueHandler* hmo, const HMLibPriority priority = HMLIB_PRIORITY_NORMAL, const uint32_t argument = 0, const uint64_t operand = 0, const uint8_t affinity = 0);
 		
+		//ASYNC API: startAsync CLAIMS EVERY ACTIVE HANDLER AND STARTS ONE COMPLETION THREAD PER HANDLER.
+		//submit SENDS ONE REQUEST ON THE NEXT HANDLER (ROUND ROBIN, OR HANDLER affinity % HANDLERS) AND RETURNS A FUTURE, OR CALLS callback FROM
+		//THE COMPLETION THREAD AS SOON AS ITS RESULT IS DONE, NOT IN SUBMIT ORDER. stopAsync WAITS FOR EVERY REQUEST IN FLIGHT AND RETURNS THE HANDLERS
+		bool startAsync();
+		bool stopAsync();
+		std::future<HMLibResult> submit(const char* input, const unsigned int size, const uint16_t code, const HMLibPriority priority = HMLIB_PRIORITY_NORMAL, const uint32_t argument = 0, const uint64_t operand = 0, const uint8_t affinity = 0);
+		int submit(const char* input, const unsigned int size, const uint16_t code, HMLibCallback callback, const HMLibPriority priority = HMLIB_PRIORITY_NORMAL, const uint32_t argument = 0, const uint64_t operand = 0, const uint8_t affinity = 0);
+
+		//REACTOR: ONE THREAD POLLS THE NEXT OUTPUT META LINE OF EVERY WAITING HANDLER AND RUNS THE READY CALLBACKS IN A BATCH.
+		//whenOutputReady CALLS resume ON THE REACTOR THREAD ONCE peekOutput ON hmo WILL NOT WAIT. stopReactor WAITS FOR EVERY REGISTERED CALLBACK.
+		//IT RETURNS false AND DROPS resume WHEN THE REACTOR IS NOT RUNNING, THE CALLER THEN WAITS IN peekOutput ITSELF
+		bool startReactor();
+		void stopReactor();
+		bool whenOutputReady(struct HMLibUniqueHandler* hmo, std::function<void()> resume);
+#if defined(__cpp_impl_coroutine)
+		//co_await awaitOutput(hmo) SUSPENDS THE COROUTINE UNTIL THE OUTPUT IS READY, IT RESUMES ON THE REACTOR THREAD
+		struct HMLibOutputAwaitable awaitOutput(struct HMLibUniqueHandler* hmo);
+#endif
+
 		bool checkMemoryValue(char* memory, const unsigned int programCounter, const uint16_t code);
+		//RETURNS AS SOON AS EVERY HANDLER ACKNOWLEDGES THE EXIT CODE, THE WRITE STATISTICS COME BACK IN THE EXIT META LINE
 		bool stopKernel();
 		void printForMe(std::string message);
 
 		void printStatistics(double& overallTime);
 };
 
+//C++20 ONLY, BUILD THE HOST WITH -std=c++20 TO USE IT
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+struct HMLibOutputAwaitable{
+	HMLib* hmlib;
+	struct HMLibUniqueHandler* hmo;
+
+	bool await_ready(){
+		return ((volatile unsigned int*)hmo->outputMetaPtr)[13] == 2;
+	}
+	bool await_suspend(std::coroutine_handle<> handle){
+		//RESUME IN PLACE IF THE REACTOR IS NOT RUNNING (OR STOPS MEANWHILE), peekOutput THEN WAITS FOR THE OUTPUT
+		return hmlib->whenOutputReady(hmo, [handle](){ handle.resume(); });
+	}
+	void await_resume(){}
+};
+
+inline struct HMLibOutputAwaitable HMLib::awaitOutput(struct HMLibUniqueHandler* hmo){
+	return HMLibOutputAwaitable{this, hmo};
+}
+#endif
+
 #endif
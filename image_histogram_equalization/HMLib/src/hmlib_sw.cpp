@@ -0,0 +1,295 @@
+#include "hmlib_sw.h"
+
+HMLibSoftwareDevice::HMLibSoftwareDevice(HMLibUserKernel kernel){
+	userKernel = kernel;
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		started[i] = false;
+	}
+}
+
+HMLibSoftwareDevice::~HMLibSoftwareDevice(){
+	finish();
+}
+
+std::string HMLibSoftwareDevice::name(){
+	return "software memAccelerate";
+}
+
+bool HMLibSoftwareDevice::start(const unsigned int handler, char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize){
+	if(handler >= HMLIB_HANDLERS || started[handler] || userKernel == nullptr){
+		return false;
+	}
+	ringServers[handler] = std::thread(&HMLibSoftwareDevice::serveRing, this, ring, bufferSections, inputSize, outSize);
+	started[handler] = true;
+	return true;
+}
+
+void HMLibSoftwareDevice::finish(){
+	for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		if(started[i]){
+			ringServers[i].join();
+			started[i] = false;
+		}
+	}
+}
+
+//SAME STEPS AS pollMeta AND sendDataUser: REQUESTS GO TO THE PEs ROUND ROBIN
+void HMLibSoftwareDevice::serveRing(char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize){
+	hls::stream<ap_uint<512> > toUser[HMLIB_PE_PER_HANDLER];
+	hls::stream<ap_axiu<514,0,0,0> > fromUser[HMLIB_PE_PER_HANDLER];
+	hls::stream<bool> stopSignal[HMLIB_PE_PER_HANDLER];
+	hls::stream<ap_uint<512> > dispatched;
+
+	std::thread users[HMLIB_PE_PER_HANDLER];
+	for(unsigned int p = 0; p < HMLIB_PE_PER_HANDLER; p++){
+		users[p] = std::thread(userKernel, std::ref(toUser[p]), std::ref(fromUser[p]), std::ref(stopSignal[p]));
+	}
+	std::thread retire(&HMLibSoftwareDevice::retireRing, this, ring, bufferSections, inputSize, outSize, fromUser, std::ref(dispatched));
+
+	char* metaStart = ring;
+	char* priorityStart = ring + bufferSections * BUS_WIDTH_BYTES + HMLIB_DOORBELL_BYTES;
+	char* inputStart = ring + bufferSections * BUS_WIDTH_BYTES + HMLIB_SLOT_OFFSET_BYTES;
+
+	unsigned int expectedProgramCounter = 1;
+	unsigned int section = 0;
+	unsigned int expectedPriorityCounter = HMLIB_PRIORITY_PC + 1;
+	unsigned int prioritySection = 0;
+	unsigned int nextPe = 0;
+	unsigned int exitCount = 0;
+	std::vector<char> unpacked;
+
+	while(exitCount < HMLIB_PE_PER_HANDLER){
+		char* ringMeta = metaStart + section * BUS_WIDTH_BYTES;
+		bool high = false;
+
+		//WAIT FOR THE HOST TO PUBLISH THE NEXT PROGRAM COUNTER IN THIS SECTION. THE HIGH PRIORITY RING IS ALWAYS
+		//LOOKED AT FIRST, LIKE pollMeta WITH HM_PRIORITY_WEIGHT=0
+		unsigned int spins = 0;
+		while(true){
+			if(HMLIB_PRIORITY_SECTIONS != 0 && ((volatile unsigned int*)(priorityStart + prioritySection * BUS_WIDTH_BYTES))[14] == expectedPriorityCounter){
+				ringMeta = priorityStart + prioritySection * BUS_WIDTH_BYTES;
+				high = true;
+				break;
+			}
+			if(((volatile unsigned int*)ringMeta)[14] == expectedProgramCounter){
+				break;
+			}
+			if(spins < 4096){
+				_mm_pause();
+				spins++;
+			}else{
+				std::this_thread::sleep_for(std::chrono::microseconds(1));
+			}
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		alignas(64) char metaLine[64];
+		memcpy(metaLine, ringMeta, 64);
+		uint16_t code = ((uint16_t*)metaLine)[0];
+		unsigned int batchCount = ((uint8_t*)metaLine)[4];
+		//A REQUEST WITH AN AFFINITY GOES TO ITS PE, THE OTHERS ROUND ROBIN. retireRing PICKS THE SAME PE FOR IT
+		unsigned int affinity = ((uint8_t*)metaLine)[5];
+		unsigned int peToUse = (affinity != 0) ? affinity % HMLIB_PE_PER_HANDLER : nextPe;
+		unsigned int iterations = ((unsigned int*)metaLine)[2];
+		unsigned int packedLines = ((uint16_t*)metaLine)[3];
+
+		//THE META LINE TRAVELS TO retireRing THE SAME WAY pollMeta HANDS IT TO receiveDataUser, WITH ITS SECTION IN THE STATUS WORD
+		ap_uint<512> metaPkt = 0;
+		for(unsigned int k = 0; k < BUS_WIDTH_BYTES; k++){
+			metaPkt.range(8*k+7,8*k) = (unsigned char)metaLine[k];
+		}
+		metaPkt.range(447,416) = high ? bufferSections + META_BURST_LINES + prioritySection : section;
+		metaPkt.range(63,48) = 0;
+		dispatched.write(metaPkt);
+
+		ap_uint<512> sendPkt = 0;
+		sendPkt.range(31,0) = code;
+		sendPkt.range(63,32) = batchCount;
+		sendPkt.range(95,64) = iterations;
+		for(unsigned int i = 0; i < MAX_BATCH_SIZE; i++){
+			sendPkt.range(127+i*32,96+i*32) = ((unsigned int*)metaLine)[3+i];
+		}
+		sendPkt.range(255,224) = ((unsigned int*)metaLine)[7];
+		sendPkt.range(319,256) = ((uint64_t*)metaLine)[4];
+		toUser[peToUse].write(sendPkt);
+
+		//THE REQUEST STARTS AT THE DATA SLOT CARRIED IN THE META LINE AND MAY SPAN SEVERAL SLOTS
+		char* inputPtr = inputStart + ((unsigned int*)metaLine)[10] * inputSize;
+		//SENT BY REFERENCE: THE SLOT HOLDS THE DESCRIPTORS, THE INPUTS ARE GATHERED LIKE memoryHandleDataReads DOES
+		unsigned int descriptors = ((uint16_t*)metaLine)[1];
+		if(descriptors != 0){
+			unpacked.resize((size_t)iterations * BUS_WIDTH_BYTES);
+			char* descriptorLine = inputPtr;
+			size_t position = 0;
+			for(unsigned int d = 0; d < descriptors && d < MAX_BATCH_SIZE; d++){
+				uint64_t lineOffset = ((uint64_t*)descriptorLine)[2*d];
+				size_t lines = ((uint32_t*)descriptorLine)[4*d+2];
+				if(position + lines * BUS_WIDTH_BYTES > unpacked.size()){
+					std::cerr << "Software memAccelerate: --- Descriptors longer than the request in section " << section << "\n";
+					break;
+				}
+				memcpy(unpacked.data() + position, (char*)((uint64_t)ring + lineOffset * BUS_WIDTH_BYTES), lines * BUS_WIDTH_BYTES);
+				position += lines * BUS_WIDTH_BYTES;
+			}
+			inputPtr = unpacked.data();
+		}
+		//AN LZ4 BLOCK IS EXPANDED FIRST, LIKE unpackDataUser DOES IN FRONT OF THE PEs
+		if(packedLines != 0){
+			unpacked.resize((size_t)iterations * BUS_WIDTH_BYTES);
+			if(!lz4Decompress(inputPtr, packedLines * BUS_WIDTH_BYTES, unpacked.data(), iterations * BUS_WIDTH_BYTES)){
+				std::cerr << "Software memAccelerate: --- Invalid LZ4 block in section " << section << "\n";
+			}
+			inputPtr = unpacked.data();
+		}
+		for(unsigned int i = 0; i < iterations; i++){
+			for(unsigned int k = 0; k < BUS_WIDTH_BYTES; k++){
+				sendPkt.range(8*k+7,8*k) = (unsigned char)inputPtr[i*BUS_WIDTH_BYTES+k];
+			}
+			toUser[peToUse].write(sendPkt);
+		}
+
+		//EVERY PE NEEDS ITS OWN EXIT CODE, THE HOST SENDS HMLIB_PE_PER_HANDLER OF THEM
+		if(code == 1){
+			exitCount++;
+		}
+
+		if(high){
+			expectedPriorityCounter++;
+			prioritySection++;
+			if(prioritySection == HMLIB_PRIORITY_SECTIONS){
+				prioritySection = 0;
+			}
+		}else{
+			expectedProgramCounter++;
+			section++;
+			if(section == bufferSections){
+				section = 0;
+			}
+		}
+		if(affinity == 0){
+			nextPe++;
+			if(nextPe == HMLIB_PE_PER_HANDLER){
+				nextPe = 0;
+			}
+		}
+	}
+
+	retire.join();
+	for(unsigned int p = 0; p < HMLIB_PE_PER_HANDLER; p++){
+		users[p].join();
+		bool exit;
+		stopSignal[p].read_nb(exit);
+	}
+}
+
+//SAME STEPS AS receiveDataUser AND memoryHandlerWrite: ONE RETIRE CONTEXT PER PE, THE PEs ARE SERVED IN TURN AND EACH ONE
+//AS LONG AS IT HAS PACKETS WAITING. A META LINE IS WRITTEN BACK TO THE SECTION IT CAME FROM AS SOON AS ITS REQUEST IS DONE
+void HMLibSoftwareDevice::retireRing(char* ring, const unsigned int bufferSections, const unsigned int inputSize, const unsigned int outSize, hls::stream<ap_axiu<514,0,0,0> >* fromUser, hls::stream<ap_uint<512> >& dispatched){
+	char* metaStart = ring;
+	char* outputStart = ring + bufferSections * BUS_WIDTH_BYTES + HMLIB_SLOT_OFFSET_BYTES + bufferSections * inputSize;
+
+	std::deque<ap_uint<512> > pendingMeta[HMLIB_PE_PER_HANDLER];
+	alignas(64) char metaLine[HMLIB_PE_PER_HANDLER][64];
+	unsigned int fsm[HMLIB_PE_PER_HANDLER] = {0};
+	unsigned int outLines[HMLIB_PE_PER_HANDLER] = {0};
+	unsigned int count[HMLIB_PE_PER_HANDLER] = {0};
+
+	unsigned int nextPe = 0;
+	unsigned int peToUse = 0;
+	unsigned int exitCount = 0;
+	unsigned int idle = 0;
+	unsigned int spins = 0;
+
+	while(exitCount < HMLIB_PE_PER_HANDLER){
+		ap_uint<512> metaPkt;
+		while(dispatched.read_nb(metaPkt)){
+			unsigned int affinity = metaPkt.range(47,40);
+			if(affinity != 0){
+				pendingMeta[affinity % HMLIB_PE_PER_HANDLER].push_back(metaPkt);
+			}else{
+				pendingMeta[nextPe].push_back(metaPkt);
+				nextPe++;
+				if(nextPe == HMLIB_PE_PER_HANDLER){
+					nextPe = 0;
+				}
+			}
+		}
+
+		unsigned int pe = peToUse;
+		char* line = metaLine[pe];
+		bool moveOn = true;
+		ap_axiu<514,0,0,0> getPkt;
+		if(fsm[pe] == 0){
+			if(!pendingMeta[pe].empty()){
+				metaPkt = pendingMeta[pe].front();
+				pendingMeta[pe].pop_front();
+				for(unsigned int k = 0; k < BUS_WIDTH_BYTES; k++){
+					line[k] = (char)(unsigned int)metaPkt.range(8*k+7,8*k);
+				}
+				outLines[pe] = 0;
+				count[pe] = 0;
+				fsm[pe] = 1;
+				moveOn = false;
+			}
+		}else if(fromUser[pe].read_nb(getPkt)){
+			moveOn = false;
+			unsigned int slot = ((unsigned int*)line)[10];
+			unsigned int outCapacity = (bufferSections - slot) * outSize;
+			char* outputPtr = outputStart + slot * outSize;
+
+			//THE FIRST PACKET BACK ACKNOWLEDGES THE CODE, EACH OUTPUT ENDS WITH A SIZE PACKET WITH BIT 512 SET
+			if(fsm[pe] == 1){
+				((uint16_t*)line)[1] = getPkt.data.range(15,0);
+				fsm[pe] = 2;
+			}else if(getPkt.data.range(512,512) == 0){
+				if(outLines[pe] * BUS_WIDTH_BYTES < outCapacity){
+					for(unsigned int k = 0; k < BUS_WIDTH_BYTES; k++){
+						outputPtr[outLines[pe]*BUS_WIDTH_BYTES+k] = (char)(unsigned int)getPkt.data.range(8*k+7,8*k);
+					}
+				}
+				outLines[pe]++;
+			}else{
+				((unsigned int*)line)[7+count[pe]] = getPkt.data.range(31,0);
+				count[pe]++;
+
+				if(count[pe] >= ((uint8_t*)line)[4]){
+					//STATUS IS WRITTEN LAST SO THE HOST NEVER SEES A HALF WRITTEN LINE AS DONE
+					char* ringMeta = metaStart + ((unsigned int*)line)[13] * BUS_WIDTH_BYTES;
+					((unsigned int*)line)[15] = ((unsigned int*)line)[14];
+					((unsigned int*)line)[13] = 1;
+					memcpy(ringMeta, line, 64);
+					std::atomic_thread_fence(std::memory_order_release);
+					((volatile unsigned int*)ringMeta)[13] = 2;
+
+					if(((uint16_t*)line)[0] == 1){
+						exitCount++;
+					}
+					fsm[pe] = 0;
+					moveOn = true;
+				}
+			}
+		}
+
+		if(moveOn){
+			peToUse++;
+			if(peToUse == HMLIB_PE_PER_HANDLER){
+				peToUse = 0;
+			}
+			idle++;
+		}else{
+			idle = 0;
+			spins = 0;
+		}
+
+		//A FULL ROUND WITH NOTHING TO DO BACKS OFF LIKE serveRing
+		if(idle >= HMLIB_PE_PER_HANDLER){
+			idle = 0;
+			if(spins < 4096){
+				_mm_pause();
+				spins++;
+			}else{
+				std::this_thread::sleep_for(std::chrono::microseconds(1));
+			}
+		}
+	}
+}
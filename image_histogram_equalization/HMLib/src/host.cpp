@@ -1,4 +1,3 @@
-#include "xcl2.hpp"
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -17,6 +16,10 @@
 #include <sys/mman.h>
 
 #include "helpers.h"
+#ifdef HMLIB_SOFTWARE
+#include "hmlib_sw.h"
+void histogram_SW(hls::stream<ap_uint<512>>& hostMemStrmToUserBuffer, hls::stream<ap_axiu<514,0,0,0> >& hostMemStrmFromUser, hls::stream<bool>& stopSignal);
+#endif
 
 #include <fstream>
 #include <iostream>
@@ -25,28 +28,37 @@
 #define NUM_INPUTSIZES 18 // number of input sizes to test
 #define INPUT_FILE_PATH "../inputs/plaintext.txt" // input file path
 #define OUTPUT_FILE_PATH "../results/timing_results.txt" // output size in bytes
-
-uint32_t crc32_for_byte(uint32_t r){
-	for(int j = 0; j < 8; j++){
-		r = (r & 1? 0: (uint32_t)0xEDB88320L) ^ r >> 1;
+//BINS OF THE EQUALIZED HISTOGRAM, ONE OUTPUT BYTE EACH. MUST MATCH BINS_NUM IN histogram.cpp
+#define HISTOGRAM_BINS 256
+
+//CPU REFERENCE OF krnl_histogram_equalization: THE SAME DOUBLE ARITHMETIC IN THE SAME ORDER, AND EVERY BIN OF THE NEW
+//HISTOGRAM TRUNCATED TO ONE BYTE THE WAY THE PE PACKS IT INTO ITS OUTPUT LINES
+void histogramReference(const char* input, const unsigned int size, unsigned char output[HISTOGRAM_BINS]){
+	double freq[HISTOGRAM_BINS] = {0};
+	double newFreq[HISTOGRAM_BINS] = {0};
+	size_t round[HISTOGRAM_BINS];
+
+	for(unsigned int i = 0; i < size; i++){
+		freq[(uint8_t)input[i]] += 1;
 	}
-	return r ^ (uint32_t)0xFF000000L;
-}
-
-uint32_t crc32(const void *data, size_t n_bytes){
-	uint32_t table[256];
-	uint32_t crc = 0;
-
-	for(uint32_t i = 0; i < 256; i++){
-		table[i] = crc32_for_byte(i);
+	double acc = 0;
+	for(unsigned int i = 0; i < HISTOGRAM_BINS; i++){
+		freq[i] /= (double)size;
 	}
-	for(uint32_t i = 0; i < n_bytes; i++){
-		crc = table[(uint8_t)crc ^ ((uint8_t*)data)[i]] ^ crc >> 8;
+	for(unsigned int i = 0; i < HISTOGRAM_BINS; i++){
+		acc += freq[i];
+		round[i] = static_cast<size_t>((HISTOGRAM_BINS - 1) * acc + 0.5);
+	}
+	for(unsigned int i = 0; i < HISTOGRAM_BINS; i++){
+		newFreq[round[i]] += freq[i];
+	}
+	for(unsigned int i = 0; i < HISTOGRAM_BINS; i++){
+		output[i] = (unsigned char)(uint64_t)newFreq[i];
 	}
-	return crc;
 }
 
 
+
 int crc_test(int argc, char* argv[]){
 
 	std::cout << "Arguments of program: ";
@@ -66,9 +78,20 @@ int crc_test(int argc, char* argv[]){
 
 	std::string filePaths = std::string(argv[1]);
 	bool enableCheck = std::stoi(argv[3]);
+	unsigned int handlers = HMLIB_HANDLERS;
+	if(argc > 4){
+		handlers = std::stoi(argv[4]);
+	}
 
 	// store the end-to-end time for each input size
 	double end_to_end_time[NUM_INPUTSIZES] = {0.0};
+
+	//ONE SESSION FOR EVERY INPUT SIZE: THE DEVICE IS PROGRAMMED ONCE, reconfigure RE-CARVES THE RINGS PER SIZE
+	//THE DEVICE MUST OUTLIVE HMLibObject, ITS DESTRUCTOR WAITS FOR THE EXIT CODE
+	#ifdef HMLIB_SOFTWARE
+	HMLibSoftwareDevice softwareDevice(histogram_SW);
+	#endif
+	HMLib HMLibObject;
 	
 	for (uint32_t curr_inputsize_index = 0; curr_inputsize_index < NUM_INPUTSIZES; curr_inputsize_index++){
 
@@ -171,42 +194,75 @@ int crc_test(int argc, char* argv[]){
 
 
 		if(enableCheck){
+			//THE RECEIVER KEEPS THE CRC OF EVERY OUTPUT, SO THE GOLDEN ANSWER IS THE CRC OF THE REFERENCE HISTOGRAM
 			for(unsigned int i = 0; i < fileData.size(); i++){
-				unsigned int val = crc32(fileData[i], fileSizes[i]);
-				crcAnswers.push_back(val);
+				unsigned char golden[HISTOGRAM_BINS];
+				histogramReference(fileData[i], fileSizes[i], golden);
+				crcAnswers.push_back(crc32(golden, HISTOGRAM_BINS));
 			}
 		}
 
 		std::thread workers[HMLIB_HANDLERS][2];
 		bool pass[HMLIB_HANDLERS][2];
 		struct HMLibUniqueHandler* HMLibUH[HMLIB_HANDLERS];
-		HMLib HMLibObject;
-		HMLibObject.initialize(std::string(argv[2]),"histogram_HM",8,inputSize,256);
+		//SMALL INPUTS GET SLOTS LARGE ENOUGH FOR MAX_BATCH_SIZE REQUESTS SO parallelTaskSend CAN BATCH THEM.
+		//A KERNEL BUILT FOR ONE RING GEOMETRY KEEPS IT, LARGER INPUTS THEN SPAN SEVERAL SLOTS
+		unsigned int sections = 8;
+		unsigned int slotInput = batchSlotSize(inputSize,inputSize);
+		unsigned int slotOutput = batchSlotSize(inputSize,256);
+		#if HMLIB_FIXED_SECTIONS
+		sections = HMLIB_FIXED_SECTIONS;
+		slotInput = HMLIB_FIXED_INPUT_SIZE;
+		slotOutput = HMLIB_FIXED_OUTPUT_SIZE;
+		#endif
+		if(curr_inputsize_index == 0){
+			#ifdef HMLIB_SOFTWARE
+			if(!HMLibObject.initialize(&softwareDevice,sections,slotInput,slotOutput,handlers)){
+			#else
+			if(!HMLibObject.initialize(std::string(argv[2]),"histogram_HM",sections,slotInput,slotOutput,handlers)){
+			#endif
+				exit(EXIT_FAILURE);
+			}
+		}else if(!HMLibObject.reconfigure(sections,slotInput,slotOutput,handlers)){
+			exit(EXIT_FAILURE);
+		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			HMLibUH[i] = HMLibObject.getHMLibUniqueHandler(i);
 			if(HMLibUH[i] == nullptr){
 				exit(EXIT_FAILURE);;
 			}
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
-			workers[i][0] = std::thread(parallelTaskSend, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(fileData), std::ref(fileSizes), std::ref(pass[i][0]));
-			workers[i][1] = std::thread(parallelTaskReceive, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(crcFPGAAnswers), entryCount, enableCheck, std::ref(pass[i][1]));
+		//SPLIT THE INPUTS INTO ONE CONTIGUOUS CHUNK PER HANDLER SO EACH SEND/RECEIVE PAIR OWNS ITS OWN RING
+		std::vector<char*> handlerData[HMLIB_HANDLERS];
+		std::vector<unsigned int> handlerSizes[HMLIB_HANDLERS];
+		std::vector<unsigned int> handlerAnswers[HMLIB_HANDLERS];
+		for(unsigned int i = 0; i < handlers; i++){
+			unsigned int first = (fileData.size() * i)/handlers;
+			unsigned int last = (fileData.size() * (i+1))/handlers;
+			handlerData[i].assign(fileData.begin()+first, fileData.begin()+last);
+			handlerSizes[i].assign(fileSizes.begin()+first, fileSizes.begin()+last);
+		}
+
+		for(unsigned int i = 0; i < handlers; i++){
+			workers[i][0] = std::thread(parallelTaskSend, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(handlerData[i]), std::ref(handlerSizes[i]), std::ref(pass[i][0]), 1, 0);
+			workers[i][1] = std::thread(parallelTaskReceive, std::ref(HMLibObject), std::ref(HMLibUH[i]), std::ref(handlerAnswers[i]), handlerData[i].size(), enableCheck, std::ref(pass[i][1]), false);
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			for(unsigned int j = 0; j < 2; j++){
 				workers[i][j].join();
 			}
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			for(unsigned int j = 0; j < 2; j++){
 				if(!pass[i][j]){
 					exit(EXIT_FAILURE);
 				}
 			}
+			crcFPGAAnswers.insert(crcFPGAAnswers.end(), handlerAnswers[i].begin(), handlerAnswers[i].end());
 		}
 
 		//TODO: WRITE YOUR GOLDEN ANSWER COMPARE HERE
@@ -225,7 +281,7 @@ int crc_test(int argc, char* argv[]){
 			}
 		}
 
-		for(unsigned int i = 0; i < HMLIB_HANDLERS; i++){
+		for(unsigned int i = 0; i < handlers; i++){
 			if(!HMLibObject.returnHMLibUniqueHandler(HMLibUH[i],i)){
 				exit(EXIT_FAILURE);
 			}
@@ -282,8 +338,8 @@ int crc_test(int argc, char* argv[]){
 
 
 int main(int argc, char* argv[]){
-	if(argc != 4){
-		std::cout << "Usage: " << argv[0] << " <input path> <XCLBIN File> <enable check>" << std::endl;
+	if(argc != 4 && argc != 5){
+		std::cout << "Usage: " << argv[0] << " <input path> <XCLBIN File> <enable check> [handlers]" << std::endl;
 		return EXIT_FAILURE;
 	}
 
@@ -1,115 +1,99 @@
 #include "hmlib_top.h"
-#include <string.h>
-void memoryHandlerWrite(hls::stream<struct writeOutPkt>& pkt, ap_uint<512>* hostMemoryBuffer, 
-	hls::stream<ap_uint<64>>& time, hls::stream<bool>& alarm, hls::stream<ap_uint<32>>& testStream){
+void memoryHandlerWrite(hls::stream<struct writeOutPkt>& pkt, hls::burst_maxi<ap_uint<512> > hostMemoryBuffer, 
+	hls::stream<ap_uint<32>>& testStream){
 	#pragma HLS inline off
 
-	const unsigned int BURST_LENGTH_PRAGMA = 8;
-	
 	ap_uint<32> exit = 0;
 	struct writeOutPkt getPkt;
-	bool brokeChain = false;
+	struct writeOutPkt nextPkt;
+	bool carry = false;
 	ap_uint<32> address = 0;
-	ap_uint<32> outstandingWrites = 0;
-	hls::stream<ap_uint<512> > values;
-	#pragma HLS stream variable=values depth=BURST_LENGTH_PRAGMA
-	hls::stream<ap_uint<32> > addresses;
-	#pragma HLS stream variable=addresses depth=BURST_LENGTH_PRAGMA
-	bool stopped = false;
+	ap_uint<32> burstLines = 0;
+	ap_uint<32> outstandingBursts = 0;
+	ap_uint<512> values[DATA_BURST_LENGTH];
 	ap_uint<64> stats[2] = {0,0};
+	struct writeOutPkt exitPkt;
 
-	SERVICE_MEMORY_WRITE: while(!stopped){
+	SERVICE_MEMORY_WRITE: while(exit != PE_PER_HANDLER){
 		#pragma HLS loop_tripcount max=10 min=10
-		#pragma HLS pipeline II=1
-
-		bool flush = false;
-		if(pkt.read_nb(getPkt)){
-			if(outstandingWrites == 0){
-				address = getPkt.addr;
-			}
-			if(getPkt.stop == 1){
-				flush = true;
-				exit++;
-			}
-			if(getPkt.stop == 2){
-				flush = true;
-			}
 
-			values.write(getPkt.value);
-			addresses.write(getPkt.addr);
-
-			if(getPkt.addr != address+outstandingWrites && !brokeChain){
-				brokeChain = true;	
-			}
-			outstandingWrites++;
-			
+		if(carry){
+			getPkt = nextPkt;
+			carry = false;
+		}else{
+			getPkt = pkt.read();
 		}
 
-		if(outstandingWrites == BURST_LENGTH_PRAGMA || flush || brokeChain){
-			if(outstandingWrites == BURST_LENGTH_PRAGMA && !brokeChain){
-				CHAIN_FLUSH: for(ap_uint<32> i = 0; i < BURST_LENGTH_PRAGMA; i++){
-					ap_uint<32> throwAddr = addresses.read();
-					hostMemoryBuffer[address+i] = values.read();
+		if(getPkt.stop == 0){
+			//OUTPUT LINES ARE GATHERED UNTIL THE BURST IS FULL, THE ADDRESS JUMPS (NEXT SLOT OR ANOTHER PE) OR A META
+			//LINE COMES IN. THE PACKET THAT ENDED THE BURST IS CARRIED INTO THE NEXT ITERATION
+			address = getPkt.addr;
+			values[0] = getPkt.value;
+			burstLines = 1;
+			GATHER_BURST: while(burstLines < DATA_BURST_LENGTH){
+				#pragma HLS pipeline II=1
+				#pragma HLS loop_tripcount max=64 min=1
+				nextPkt = pkt.read();
+				if(nextPkt.stop != 0 || nextPkt.addr != address+burstLines){
+					carry = true;
+					break;
 				}
+				values[burstLines] = nextPkt.value;
+				burstLines++;
+			}
+
+			hostMemoryBuffer.write_request(address, burstLines);
+			WRITE_BURST: for(ap_uint<32> i = 0; i < burstLines; i++){
+				#pragma HLS pipeline II=1
+				#pragma HLS loop_tripcount max=64 min=1
+				hostMemoryBuffer.write(values[i]);
+			}
+			if(burstLines == DATA_BURST_LENGTH){
 				stats[0]++;
 			}else{
-				BREAK_CHAIN_FLUSH: for(ap_uint<32> i = 0; i < BURST_LENGTH_PRAGMA; i++){
-					if(i < outstandingWrites-1){
-						hostMemoryBuffer[addresses.read()] = values.read();
-					}
-				}
-				ENFORCE_SLEEP:{
-					time.write(4);
-					ap_wait();
-					bool wait = alarm.read();
-					if(wait){
-						hostMemoryBuffer[addresses.read()] = values.read();
-					}
-				}
-				stats[1]++;	
+				stats[1]++;
 			}
 
-			brokeChain = false;
-			address = 0;
-			outstandingWrites = 0;
-		}
-		if(exit == PE_PER_HANDLER){
-			stopped = true;
-		}
-		
-	}
-
-	time.write(0);
-	ap_uint<512> put = 0;
-	put.range(63,0) = stats[0];
-	put.range(127,64) = stats[1];
-	put.range(191,128) = testStream.read();
-	hostMemoryBuffer[0] = put;
-}
-
-void sleepTimer(hls::stream<ap_uint<64>>& time, hls::stream<bool>& alarm){
-	#pragma HLS inline off
-	ap_uint<64> counter = 0;
-	ap_uint<64> sleepTime = 0;
-
-	SLEEP_TIMER: while(true){
-		#pragma HLS pipeline II=1
-		#pragma HLS loop_tripcount max=10 min=10
+			outstandingBursts++;
+			if(outstandingBursts == WRITE_OUTSTANDING){
+				hostMemoryBuffer.write_response();
+				outstandingBursts--;
+			}
+		}else{
+			//A META LINE GOES OUT ONLY ONCE EVERY OUTPUT LINE BEFORE IT HAS BEEN ACKNOWLEDGED, SO THE HOST
+			//NEVER SEES STATUS 2 AHEAD OF THE DATA
+			WAIT_WRITE_RESPONSES: while(outstandingBursts != 0){
+				#pragma HLS loop_tripcount max=4 min=1
+				hostMemoryBuffer.write_response();
+				outstandingBursts--;
+			}
 
-		if(counter == sleepTime){
-			if(sleepTime != 0){
-				alarm.write(true);
-				sleepTime = 0;
+			if(getPkt.stop == 1){
+				exit++;
 			}
-			bool read = time.read_nb(sleepTime);
-			if(sleepTime == 0 && read){
-				break;
+			if(getPkt.stop == 1 && exit == PE_PER_HANDLER){
+				//THE LAST EXIT META LINE IS HELD BACK AND WRITTEN LAST, CARRYING THE STATISTICS
+				exitPkt = getPkt;
+			}else{
+				hostMemoryBuffer.write_request(getPkt.addr, 1);
+				hostMemoryBuffer.write(getPkt.value);
+				outstandingBursts++;
 			}
-			counter = 0;
-		}else{
-			counter++;
 		}
 	}
+
+	//THE HOST SEES THE EXIT ACKNOWLEDGEMENT AND THE STATISTICS TOGETHER, NO META LINE IS OVERWRITTEN AFTER IT
+	WAIT_LAST_RESPONSES: while(outstandingBursts != 0){
+		#pragma HLS loop_tripcount max=4 min=1
+		hostMemoryBuffer.write_response();
+		outstandingBursts--;
+	}
+	exitPkt.value.range(191,128) = stats[0];
+	exitPkt.value.range(255,192) = stats[1];
+	exitPkt.value.range(319,256) = testStream.read();
+	hostMemoryBuffer.write_request(exitPkt.addr, 1);
+	hostMemoryBuffer.write(exitPkt.value);
+	hostMemoryBuffer.write_response();
 }
 
 void cycleCounter(hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& outputCycle){
@@ -132,83 +116,175 @@ void cycleCounter(hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& ou
 	}
 }
 
-void memoryHandleReadRequests(ap_uint<512>* hostMemorySection, 
+//META LINES AND THE DOORBELL ARE READ ON THEIR OWN m_axi MASTER, SO A LONG DATA READ NEVER HOLDS BACK THE NEXT META FETCH
+void memoryHandleMetaReads(hls::burst_maxi<ap_uint<512> > hostMemoryMeta, 
 	hls::stream<struct readPktReq>& readRequestMeta, 
+	hls::stream<ap_uint<512>>& valueResponseMeta){
+
+	#pragma HLS inline off
+
+	READ_META_FETCH: while(true){
+		#pragma HLS loop_tripcount max=10 min=10
+
+		struct readPktReq getPkt = readRequestMeta.read();
+		if(getPkt.stop == 1){
+			break;
+		}
+
+		//pollMeta NEVER ASKS FOR MORE THAN BURST_LENGTH LINES
+		hostMemoryMeta.read_request(getPkt.addr, getPkt.size);
+		READ_META_BURST: for(ap_uint<32> i = 0; i < getPkt.size; i++){
+			#pragma HLS pipeline II=1
+			#pragma HLS loop_tripcount max=8 min=1
+			valueResponseMeta.write(hostMemoryMeta.read());
+		}
+	}
+}
+
+//INPUT DATA IS READ IN BURSTS OF UP TO DATA_BURST_LENGTH LINES WITH UP TO READ_OUTSTANDING BURSTS REQUESTED AHEAD OF THE
+//LINES BEING PASSED ON, SO THE NEXT REQUEST'S INPUT IS ALREADY ON ITS WAY WHILE sendDataUser IS STILL FEEDING THE PEs
+void memoryHandleDataReads(hls::burst_maxi<ap_uint<512> > hostMemorySection, 
 	hls::stream<struct readPktReq>& readRequestData, 
-	hls::stream<ap_uint<512>>& valueResponseMeta,
 	hls::stream<ap_uint<512>>& valueResponseData){
 
 	#pragma HLS inline off
 
-	hls::stream<struct readPktReq> feedBack;
-	#pragma HLS stream variable=feedBack depth=2
-	ap_uint<1> multiplex = 0;
-	ap_uint<1> multiplexStore = 0;
-	ap_uint<32> counter = 0;
+	//LENGTH OF EVERY BURST REQUESTED BUT NOT PASSED ON YET, OLDEST FIRST
+	const unsigned int READ_OUTSTANDING_PRAGMA = READ_OUTSTANDING;
+	hls::stream<ap_uint<32> > burstsInFlight;
+	#pragma HLS stream variable=burstsInFlight depth=READ_OUTSTANDING_PRAGMA
 
-	READ_REQ_FETCH: while(true){
-		#pragma HLS pipeline
+	struct readPktReq getPkt;
+	getPkt.size = 0;
+	getPkt.gather = 0;
+	ap_uint<32> linesLeft = 0;
+	bool stopped = false;
+
+	//A GATHER READ FIRST FETCHES ITS DESCRIPTOR LINE (A BURST OF 0 LINES IN burstsInFlight), NO OTHER REQUEST IS TAKEN
+	//UNTIL IT IS BACK. ITS PAIRS ARE THEN READ ONE AFTER THE OTHER LIKE ORDINARY REQUESTS
+	ap_uint<512> descriptorLine = 0;
+	ap_uint<3> descriptorsLeft = 0;
+	bool descriptorWait = false;
+
+	READ_DATA_FETCH: while(!stopped || linesLeft != 0 || !burstsInFlight.empty()){
+		#pragma HLS pipeline II=1
 		#pragma HLS loop_tripcount max=10 min=10
 
-		bool readyToGet = false;
-		struct readPktReq getPkt;
-
-		if(feedBack.read_nb(getPkt)){
-			readyToGet = true;
-			multiplex = multiplexStore;
-		}else if(readRequestData.read_nb(getPkt)){
-			readyToGet = true;
-			multiplex = 1;
-		}else if(readRequestMeta.read_nb(getPkt)){
-			readyToGet = true;
-			multiplex = 0;
-		}	
-
-		if(readyToGet){
-			ap_uint<512> value[BURST_LENGTH];
-
-			memcpy(value,hostMemorySection+getPkt.addr,BURST_LENGTH*64);
-			for(ap_uint<32> i = 0; i < BURST_LENGTH; i++){
-				if(multiplex == 0 && i < getPkt.size){
-					valueResponseMeta.write(value[i]);
-				}else if(multiplex == 1 && i < getPkt.size){
-					valueResponseData.write(value[i]);
+	#if HM_GATHER
+		if(getPkt.size == 0 && !descriptorWait && descriptorsLeft != 0){
+			getPkt.addr = descriptorLine.range(63,0);
+			getPkt.size = descriptorLine.range(95,64);
+			getPkt.gather = 0;
+			descriptorLine = descriptorLine >> 128;
+			descriptorsLeft--;
+		}else
+	#endif
+		if(getPkt.size == 0 && !stopped && !descriptorWait && descriptorsLeft == 0){
+			if(readRequestData.read_nb(getPkt)){
+				if(getPkt.stop == 1){
+					stopped = true;
+					getPkt.size = 0;
 				}
 			}
-			if(getPkt.size > BURST_LENGTH){
-				getPkt.addr += BURST_LENGTH;
-				getPkt.size -= BURST_LENGTH;
-				multiplexStore = multiplex;
-				feedBack.write(getPkt);
+		}
+
+		if(getPkt.size != 0 && !burstsInFlight.full()){
+		#if HM_GATHER
+			if(getPkt.gather != 0){
+				hostMemorySection.read_request(getPkt.addr, 1);
+				burstsInFlight.write(0);
+				descriptorsLeft = getPkt.gather;
+				descriptorWait = true;
+				getPkt.size = 0;
+			}else
+		#endif
+			{
+				ap_uint<32> lines = DATA_BURST_LENGTH;
+				if(getPkt.size < DATA_BURST_LENGTH){
+					lines = getPkt.size;
+				}
+				hostMemorySection.read_request(getPkt.addr, lines);
+				burstsInFlight.write(lines);
+				getPkt.addr += lines;
+				getPkt.size -= lines;
 			}
 		}
 
-		if(getPkt.stop == 1){
-			break;
+		if(linesLeft == 0){
+			ap_uint<32> lines;
+			if(burstsInFlight.read_nb(lines)){
+			#if HM_GATHER
+				if(lines == 0){
+					descriptorLine = hostMemorySection.read();
+					descriptorWait = false;
+				}
+			#endif
+				linesLeft = lines;
+			}
+		}else{
+			valueResponseData.write(hostMemorySection.read());
+			linesLeft--;
 		}
 	}
 }
 
+template<typename GEOMETRY>
 void pollMeta(hls::stream<struct readPktReq>& readRequestMeta, 
 	hls::stream<struct readPktReq>& readRequestData,
 	hls::stream<ap_uint<512>>& valueMeta, 
-	hls::stream<ap_uint<512>> toProcTask[2], 
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE,
+	hls::stream<ap_uint<512>> toProcTask[META_CONSUMERS], 
+	const GEOMETRY geometry,
 	hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& outputCycle, hls::stream<ap_uint<32>>& testStream){
 
 	#pragma HLS inline off
+	const ap_uint<32> BUFFER_SECTIONS = geometry.sections();
+	const ap_uint<32> DATA_IN_SECTION_SIZE = geometry.inLines();
+	const ap_uint<32> DATA_OUT_SECTION_SIZE = geometry.outLines();
 	ap_uint<32> tmp = 0;
 	ap_uint<64> diff = 0;
 	ap_uint<64> valueCounter = 0;
 	ap_int<32> tracker = 0;
 
-	ap_uint<32> expectedProgramCounter = 1;
-	ap_uint<32> currentProgramCounter = 0;
-	ap_uint<32> bufferSectionCounter = 0;
+	//ONE ENTRY PER META RING: 0 IS THE NORMAL RING, 1 THE HIGH PRIORITY RING AFTER THE DOORBELL BURST
+	ap_uint<32> expectedProgramCounter[META_RINGS];
+	ap_uint<32> currentProgramCounter[META_RINGS];
+	ap_uint<32> bufferSectionCounter[META_RINGS];
+	ap_uint<32> ringSections[META_RINGS];
+	ap_uint<32> ringBase[META_RINGS];
+	#pragma HLS array_partition variable=expectedProgramCounter dim=0 complete
+	#pragma HLS array_partition variable=currentProgramCounter dim=0 complete
+	#pragma HLS array_partition variable=bufferSectionCounter dim=0 complete
+	#pragma HLS array_partition variable=ringSections dim=0 complete
+	#pragma HLS array_partition variable=ringBase dim=0 complete
 	ap_uint<32> breakOut = 0;
 	bool prefetchTrigger = false;
 	bool sendOnce = false;
 
+	//DOORBELL LINE AFTER THE META SECTIONS, THE HOST KEEPS THE NEWEST PROGRAM COUNTER IT PUBLISHED ON EACH RING IN IT
+	const ap_uint<32> DOORBELL = BUFFER_SECTIONS;
+	bool ringing = false;
+	ap_uint<32> producerProgramCounter[META_RINGS];
+	ap_uint<32> fetchedProgramCounter[META_RINGS];
+	ap_uint<32> fetchSection[META_RINGS];
+	#pragma HLS array_partition variable=producerProgramCounter dim=0 complete
+	#pragma HLS array_partition variable=fetchedProgramCounter dim=0 complete
+	#pragma HLS array_partition variable=fetchSection dim=0 complete
+	//META LINES IN FLIGHT ALL COME FROM fetchRing, THE OTHER RING IS ONLY FETCHED FROM ONCE THEY ARE BACK
+	ap_uint<1> fetchRing = 0;
+	ap_uint<32> priorityStreak = 0;
+
+	for(ap_uint<32> r = 0; r < META_RINGS; r++){
+		ap_uint<32> firstProgramCounter = (r == 0) ? 0 : PRIORITY_PC;
+		expectedProgramCounter[r] = firstProgramCounter + 1;
+		currentProgramCounter[r] = firstProgramCounter;
+		producerProgramCounter[r] = firstProgramCounter;
+		fetchedProgramCounter[r] = firstProgramCounter;
+		bufferSectionCounter[r] = 0;
+		fetchSection[r] = 0;
+		ringSections[r] = (r == 0) ? BUFFER_SECTIONS : (ap_uint<32>)PRIORITY_SECTIONS;
+		ringBase[r] = (r == 0) ? (ap_uint<32>)0 : (ap_uint<32>)(BUFFER_SECTIONS + DOORBELL_LINES);
+	}
+
 	SEND_META: while(breakOut != PE_PER_HANDLER){
 		#pragma HLS pipeline
 		#pragma HLS loop_tripcount max=10 min=10
@@ -219,30 +295,109 @@ void pollMeta(hls::stream<struct readPktReq>& readRequestMeta,
 			valueCounter = outputCycle.read();
 		}
 
+	#if HM_DOORBELL
+		ap_uint<1> ring = fetchRing;
+	#if META_RINGS > 1
+		//HIGH PRIORITY META LINES GO FIRST, WITH HM_PRIORITY_WEIGHT A NORMAL FETCH IS LET THROUGH EVERY SO OFTEN
+		if(tracker == 0){
+			bool normalWaiting = producerProgramCounter[0] != fetchedProgramCounter[0];
+			bool priorityWaiting = producerProgramCounter[1] != fetchedProgramCounter[1];
+			if(priorityWaiting && (!normalWaiting || HM_PRIORITY_WEIGHT == 0 || priorityStreak < HM_PRIORITY_WEIGHT)){
+				ring = 1;
+			}else{
+				ring = 0;
+			}
+		}
+	#endif
+		//META LINES THE DOORBELL ANNOUNCED ARE FETCHED AT ONCE, A BURST AT A TIME AND NEVER PAST THE END OF THE RING.
+		//ONCE EVERYTHING IS IN, ONE DOORBELL LINE IS READ EVERY 32 CYCLES, SO AN IDLE HOST COSTS ONE LINE INSTEAD OF A BURST
+		if(!ringing && tracker <= BURST_LENGTH && producerProgramCounter[ring] != fetchedProgramCounter[ring]){
+			ap_uint<32> lines = producerProgramCounter[ring] - fetchedProgramCounter[ring];
+			if(lines > BURST_LENGTH){
+				lines = BURST_LENGTH;
+			}
+			if(lines > ringSections[ring] - fetchSection[ring]){
+				lines = ringSections[ring] - fetchSection[ring];
+			}
+
+			readPktReq reqMeta;
+			reqMeta.size = lines;
+			reqMeta.addr = ringBase[ring] + fetchSection[ring];
+			reqMeta.stop = 0;
+			reqMeta.gather = 0;
+
+			if(readRequestMeta.write_nb(reqMeta)){
+				tracker += lines;
+				fetchedProgramCounter[ring] += lines;
+				fetchSection[ring] += lines;
+				if(fetchSection[ring] == ringSections[ring]){
+					fetchSection[ring] = 0;
+				}
+				fetchRing = ring;
+				if(ring == 1){
+					priorityStreak++;
+				}else{
+					priorityStreak = 0;
+				}
+			}
+		}else if(!ringing && tracker == 0 && valueCounter - diff >= 32){
+			readPktReq reqBell;
+			reqBell.size = 1;
+			reqBell.addr = DOORBELL;
+			reqBell.stop = 0;
+			reqBell.gather = 0;
+
+			if(readRequestMeta.write_nb(reqBell)){
+				ringing = true;
+				tracker++;
+			}
+			diff = valueCounter;
+		}
+	#else
 		if(valueCounter - diff >= 32 && tracker <= BURST_LENGTH){
+			//ONLY THE BURST HOLDING THE NEXT EXPECTED META IS POLLED, SO A DEEP RING COSTS NO EXTRA READS
+			//THE HOST ROUNDS THE META SECTIONS UP TO A MULTIPLE OF BURST_LENGTH
+			tmp = bufferSectionCounter[0] - (bufferSectionCounter[0] % BURST_LENGTH);
+
 			readPktReq reqMeta;
 			reqMeta.size = BURST_LENGTH;
 			reqMeta.addr = tmp;
 			reqMeta.stop = 0;
+			reqMeta.gather = 0;
 			
 			if(readRequestMeta.write_nb(reqMeta)){
 				tracker += BURST_LENGTH;
-				tmp += BURST_LENGTH;
-				if(tmp == BUFFER_SECTIONS){
-					tmp = 0;
-				}
 			}
 			diff = valueCounter;
 		}
+	#endif
 	
 		ap_uint<512> getMetaData;
 		if(valueMeta.read_nb(getMetaData)){
-			if(getMetaData.range(479,448) != currentProgramCounter && getMetaData.range(479,448) == expectedProgramCounter){
+			//LINES COME BACK IN THE ORDER THEY WERE ASKED FOR, EVERY ONE STILL OUTSTANDING BELONGS TO fetchRing
+			ap_uint<1> r = fetchRing;
+		#if HM_DOORBELL
+			//THE DOORBELL IS ONLY READ WITH NOTHING ELSE OUTSTANDING, SO IT IS THE NEXT LINE BACK
+			if(ringing){
+				for(ap_uint<32> k = 0; k < META_RINGS; k++){
+					producerProgramCounter[k] = getMetaData.range(k*32+31,k*32);
+				}
+				ringing = false;
+			}else
+		#endif
+			if(getMetaData.range(479,448) != currentProgramCounter[r] && getMetaData.range(479,448) == expectedProgramCounter[r]){
 				if(getMetaData.range(15,0) == 1){
 					breakOut++;
 				}
+			#if HM_COMPRESS
+				//unpackDataUser TAKES THE LINE AS THE HOST WROTE IT, THE LINES THE REQUEST TAKES IN THE RING ARE IN BITS 48-63
+				ap_uint<32> packedLines = getMetaData.range(63,48);
+				toProcTask[2].write(getMetaData);
+			#endif
+				//BITS 48-63 ONLY GO BACK TO THE HOST AS THE PREFETCH MARKER
 				if(!prefetchTrigger){
 					prefetchTrigger = true;
+					getMetaData.range(63,48) = 0;
 				}else{
 					getMetaData.range(63,48) = 12345;
 				}
@@ -254,26 +409,44 @@ void pollMeta(hls::stream<struct readPktReq>& readRequestMeta,
 
 				toRecvProc = getMetaData;
 				toSendProc = getMetaData;
+				//receiveDataUser MAY RETIRE OUT OF ORDER, IT WRITES THE RESULT BACK TO THE META LINE PASSED IN THE STATUS WORD
+				toRecvProc.range(447,416) = ringBase[r] + bufferSectionCounter[r];
 
 				toProcTask[0].write(toSendProc);
 				toProcTask[1].write(toRecvProc);
 
 				readPktReq reqData;
 				reqData.size = getMetaData.range(95,64);
-				reqData.addr = BUFFER_SECTIONS+bufferSectionCounter*DATA_IN_SECTION_SIZE;
+			#if HM_COMPRESS
+				if(packedLines != 0){
+					reqData.size = packedLines;
+				}
+			#endif
+				//META SECTIONS ARE USED IN ORDER, THE FIRST DATA SLOT OF THE REQUEST COMES IN THE META LINE
+				reqData.addr = BUFFER_SECTIONS+SLOT_OFFSET_LINES+getMetaData.range(351,320)*DATA_IN_SECTION_SIZE;
 				reqData.stop = 0;
+				reqData.gather = 0;
+			#if HM_GATHER
+				//SENT BY REFERENCE: THE SLOT HOLDS THE DESCRIPTOR LINE, memoryHandleDataReads FOLLOWS IT
+				reqData.gather = getMetaData.range(18,16);
+			#endif
 
 				
 				readRequestData.write(reqData);
 
-				bufferSectionCounter++;
-				currentProgramCounter++;
-				expectedProgramCounter++;
-				if(bufferSectionCounter == BUFFER_SECTIONS){
-					bufferSectionCounter = 0;
+				bufferSectionCounter[r]++;
+				currentProgramCounter[r]++;
+				expectedProgramCounter[r]++;
+				if(bufferSectionCounter[r] == ringSections[r]){
+					bufferSectionCounter[r] = 0;
 				}
 			}else{
 				prefetchTrigger = false;
+			#if HM_DOORBELL
+				//NOT THE LINE EXPECTED (NOT VISIBLE YET), EVERYTHING FROM IT ON IS FETCHED AGAIN
+				fetchedProgramCounter[r] = currentProgramCounter[r];
+				fetchSection[r] = bufferSectionCounter[r];
+			#endif
 			}
 			tracker--;
 		}
@@ -291,12 +464,257 @@ void pollMeta(hls::stream<struct readPktReq>& readRequestMeta,
 		reqMeta.size = 0;
 		reqMeta.addr = 0;
 		reqMeta.stop = 1;
+		reqMeta.gather = 0;
 		readRequestMeta.write(reqMeta);
+		readRequestData.write(reqMeta);
 		ap_wait();
 		command.write(0);
 	}
 }
 
+#if HM_COMPRESS
+#define LZ4_TOKEN 0
+#define LZ4_LITERAL_LENGTH 1
+#define LZ4_LITERALS 2
+#define LZ4_OFFSET_LOW 3
+#define LZ4_OFFSET_HIGH 4
+#define LZ4_MATCH_LENGTH 5
+#define LZ4_MATCH 6
+
+//BYTES OF LITERALS OR MATCH unpackDataUser EXPANDS A CYCLE, AND THE BYTES OF OUTPUT IT KEEPS IN REGISTERS (recent).
+//UNPACK_BYTES STAYS 8, THE WINDOW BANK OF A BYTE IS THE LOW 3 BITS OF ITS POSITION
+#define UNPACK_BYTES 8
+#define UNPACK_RECENT_BYTES 128
+
+//A NEW SEQUENCE: LITERALS IN THE HIGH NIBBLE OF THE TOKEN, THE MATCH LENGTH LESS 4 IN THE LOW ONE. 15 IS CONTINUED IN LENGTH BYTES
+void lz4Token(ap_uint<8> token, ap_uint<32>& literals, ap_uint<32>& matchLength, ap_uint<3>& lz4){
+	#pragma HLS inline
+	literals = token.range(7,4);
+	matchLength = token.range(3,0) + 4;
+	if(literals == 15){
+		lz4 = LZ4_LITERAL_LENGTH;
+	}else if(literals != 0){
+		lz4 = LZ4_LITERALS;
+	}else{
+		lz4 = LZ4_OFFSET_LOW;
+	}
+}
+
+//EXPANDS A REQUEST THE HOST SENT AS AN LZ4 BLOCK BACK INTO THE LINES sendDataUser EXPECTS. LITERALS AND MATCHES ARE COPIED
+//UP TO UNPACK_BYTES A CYCLE, NEVER PAST THE END OF A PACKED LINE. THE CYCLE THAT ENDS THE LITERALS ALSO TAKES THE
+//OFFSET AND THE ONE THAT ENDS THE MATCH THE NEXT TOKEN WHEN THEY ARE IN THE PACKED LINE, SO A SHORT SEQUENCE TAKES TWO CYCLES.
+//A REQUEST SENT AS IS PASSES THROUGH A LINE A CYCLE. THE BLOCK ENDS WITH THE LAST LINE OF THE REQUEST,
+//WHAT IS LEFT OF THE PACKED LINES AFTER THAT IS DROPPED
+void unpackDataUser(hls::stream<ap_uint<512>>& valueData,
+	hls::stream<ap_uint<512>>& fromWaitTask,
+	hls::stream<ap_uint<512>>& unpackedData){
+
+	#pragma HLS inline off
+
+	//THE LAST HM_COMPRESS_WINDOW BYTES OF THE REQUEST, BYTE p IN BANK p % UNPACK_BYTES SO A COPY READS AND WRITES EVERY BANK ONCE.
+	//A BYTE IS ONLY READ BACK AFTER AT LEAST 15 CYCLES, MATCHES UP TO UNPACK_RECENT_BYTES BACK COPY FROM recent
+	ap_uint<8> window[UNPACK_BYTES][HM_COMPRESS_WINDOW/UNPACK_BYTES];
+	#pragma HLS array_partition variable=window type=complete dim=1
+	#pragma HLS bind_storage variable=window type=ram_s2p impl=bram
+	#pragma HLS dependence variable=window type=inter dependent=false
+	//THE LAST UNPACK_RECENT_BYTES BYTES OF OUTPUT, THE LATEST ONE IN THE TOP BYTE
+	ap_uint<UNPACK_RECENT_BYTES*8> recent = 0;
+
+	ap_uint<32> fsm = 0;
+	ap_uint<3> lz4 = LZ4_TOKEN;
+	ap_uint<512> metaData = 0;
+	ap_uint<32> totalLines = 0;
+	ap_uint<32> packedLines = 0;
+	ap_uint<32> linesIn = 0;
+	ap_uint<32> linesOut = 0;
+	ap_uint<512> inLine = 0;
+	ap_uint<7> inBytes = 0;
+	//THE OUTPUT LINE BEING FILLED, ITS LATEST BYTE ON TOP. A COPY MAY RUN UP TO UNPACK_BYTES PAST THE END OF THE LINE
+	ap_uint<(64+UNPACK_BYTES)*8> outLine = 0;
+	ap_uint<7> outBytes = 0;
+	ap_uint<32> outPosition = 0;
+	ap_uint<32> literals = 0;
+	ap_uint<32> matchLength = 0;
+	ap_uint<16> offset = 0;
+	ap_uint<16> exitCount = 0;
+
+	UNPACK_INPUTS_DATA: while(true){
+		#pragma HLS loop_tripcount max=20 min=20
+		#pragma HLS pipeline II=1
+
+		//BYTE j OF value IS OUTPUT BYTE outPosition + j, THE FIRST emitBytes OF THEM ARE EMITTED
+		ap_uint<4> emitBytes = 0;
+		ap_uint<UNPACK_BYTES*8> value = 0;
+
+		if(fsm == 0){
+			if(fromWaitTask.read_nb(metaData)){
+				totalLines = metaData.range(95,64);
+				packedLines = metaData.range(63,48);
+				linesIn = 0;
+				linesOut = 0;
+				inBytes = 0;
+				outBytes = 0;
+				outPosition = 0;
+				lz4 = LZ4_TOKEN;
+				if(packedLines == 0){
+					fsm = 1;
+				}else{
+					fsm = 2;
+				}
+			}
+		}else if(fsm == 1){
+			if(linesOut == totalLines){
+				fsm = 3;
+			}else{
+				ap_uint<512> sendData;
+				if(valueData.read_nb(sendData)){
+					unpackedData.write(sendData);
+					linesOut++;
+				}
+			}
+		}else if(fsm == 2){
+			if(linesOut == totalLines){
+				fsm = 3;
+			}else if(lz4 == LZ4_MATCH){
+				emitBytes = UNPACK_BYTES;
+				if(matchLength < UNPACK_BYTES){
+					emitBytes = matchLength;
+				}
+				if(offset <= UNPACK_RECENT_BYTES){
+					//A MATCH CLOSER THAN UNPACK_BYTES REPEATS ITS LAST offset BYTES
+					for(unsigned int j = 0; j < UNPACK_BYTES; j++){
+						#pragma HLS unroll
+						ap_uint<16> distance = offset - ((j < offset) ? j : j % offset);
+						value.range(8*j+7,8*j) = (recent >> ((UNPACK_RECENT_BYTES - distance) * 8)).range(7,0);
+					}
+				}else{
+					ap_uint<32> source = outPosition - offset;
+					ap_uint<UNPACK_BYTES*8> banks = 0;
+					for(unsigned int b = 0; b < UNPACK_BYTES; b++){
+						#pragma HLS unroll
+						ap_uint<3> j = b - source.range(2,0);
+						ap_uint<32> position = source + j;
+						banks.range(8*b+7,8*b) = window[b][(position / UNPACK_BYTES) % (HM_COMPRESS_WINDOW/UNPACK_BYTES)];
+					}
+					for(unsigned int j = 0; j < UNPACK_BYTES; j++){
+						#pragma HLS unroll
+						ap_uint<3> b = source.range(2,0) + j;
+						value.range(8*j+7,8*j) = banks.range(8*b+7,8*b);
+					}
+				}
+				matchLength -= emitBytes;
+				if(matchLength == 0){
+					lz4 = LZ4_TOKEN;
+					if(inBytes != 0){
+						lz4Token(inLine.range(7,0), literals, matchLength, lz4);
+						inLine = inLine >> 8;
+						inBytes--;
+					}
+				}
+			}else if(inBytes == 0){
+				if(valueData.read_nb(inLine)){
+					inBytes = 64;
+					linesIn++;
+				}
+			}else if(lz4 == LZ4_LITERALS){
+				emitBytes = UNPACK_BYTES;
+				if(literals < UNPACK_BYTES){
+					emitBytes = literals;
+				}
+				if(inBytes < emitBytes){
+					emitBytes = inBytes;
+				}
+				value = inLine.range(UNPACK_BYTES*8-1,0);
+				ap_uint<512> rest = inLine >> (emitBytes * 8);
+				inBytes -= emitBytes;
+				literals -= emitBytes;
+				//THE LAST SEQUENCE OF A BLOCK HAS NO MATCH, WHAT IS TAKEN AS ITS OFFSET IS NEVER USED
+				if(literals != 0){
+					inLine = rest;
+				}else if(inBytes >= 2){
+					offset = rest.range(15,0);
+					inLine = rest >> 16;
+					inBytes -= 2;
+					lz4 = (matchLength == 19) ? LZ4_MATCH_LENGTH : LZ4_MATCH;
+				}else{
+					inLine = rest;
+					lz4 = LZ4_OFFSET_LOW;
+				}
+			}else if(lz4 == LZ4_OFFSET_LOW && inBytes >= 2){
+				offset = inLine.range(15,0);
+				inLine = inLine >> 16;
+				inBytes -= 2;
+				lz4 = (matchLength == 19) ? LZ4_MATCH_LENGTH : LZ4_MATCH;
+			}else{
+				ap_uint<8> packed = inLine.range(7,0);
+				inLine = inLine >> 8;
+				inBytes--;
+
+				if(lz4 == LZ4_TOKEN){
+					lz4Token(packed, literals, matchLength, lz4);
+				}else if(lz4 == LZ4_LITERAL_LENGTH){
+					literals += packed;
+					if(packed != 255){
+						lz4 = LZ4_LITERALS;
+					}
+				}else if(lz4 == LZ4_OFFSET_LOW){
+					offset.range(7,0) = packed;
+					lz4 = LZ4_OFFSET_HIGH;
+				}else if(lz4 == LZ4_OFFSET_HIGH){
+					offset.range(15,8) = packed;
+					if(matchLength == 19){
+						lz4 = LZ4_MATCH_LENGTH;
+					}else{
+						lz4 = LZ4_MATCH;
+					}
+				}else{
+					matchLength += packed;
+					if(packed != 255){
+						lz4 = LZ4_MATCH;
+					}
+				}
+			}
+		}else{
+			//THE BLOCK MAY END INSIDE ITS LAST PACKED LINE OR LEAVE PADDING LINES BEHIND
+			if(linesIn >= packedLines){
+				fsm = 0;
+				if(metaData.range(15,0) == 1){
+					exitCount++;
+					if(exitCount == PE_PER_HANDLER){
+						break;
+					}
+				}
+			}else{
+				ap_uint<512> dropData;
+				if(valueData.read_nb(dropData)){
+					linesIn++;
+				}
+			}
+		}
+
+		if(emitBytes != 0){
+			for(unsigned int b = 0; b < UNPACK_BYTES; b++){
+				#pragma HLS unroll
+				ap_uint<3> j = b - outPosition.range(2,0);
+				ap_uint<32> position = outPosition + j;
+				if(j < emitBytes){
+					window[b][(position / UNPACK_BYTES) % (HM_COMPRESS_WINDOW/UNPACK_BYTES)] = value.range(8*j+7,8*j);
+				}
+			}
+			recent = (recent >> (emitBytes * 8)) | (ap_uint<UNPACK_RECENT_BYTES*8>(value) << ((UNPACK_RECENT_BYTES - emitBytes) * 8));
+			outLine = (outLine >> (emitBytes * 8)) | (ap_uint<(64+UNPACK_BYTES)*8>(value) << ((64 + UNPACK_BYTES - emitBytes) * 8));
+			outPosition += emitBytes;
+			outBytes += emitBytes;
+			if(outBytes >= 64){
+				unpackedData.write((outLine >> ((64 + UNPACK_BYTES - outBytes) * 8)).range(511,0));
+				outBytes -= 64;
+				linesOut++;
+			}
+		}
+	}
+}
+#endif
+
 void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 	hls::stream<ap_uint<512>>& fromWaitTask,
 	hls::stream<ap_uint<512> > rerouteToUser[PE_PER_HANDLER]){
@@ -310,6 +728,8 @@ void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 	ap_uint<32> batchCount = 0;
 	ap_uint<32> totalIterations = 0;
 	ap_uint<16> peToUse = 0;
+	ap_uint<16> nextPe = 0;
+	ap_uint<16> exitCount = 0;
 	ap_uint<128> elements = 0;
 	ap_uint<512> fromWaitProc;
 
@@ -325,15 +745,22 @@ void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 				fsm = 1;
 			}
 		}else if(fsm == 1){
-			batchCount = metaData.range(63,32);
+			batchCount = metaData.range(39,32);
 			elements = metaData.range(223,96);
 
+			//A REQUEST WITH AN AFFINITY GOES TO ITS PE, THE OTHERS ROUND ROBIN. receiveDataUser PICKS THE SAME PE FOR IT
+			ap_uint<8> affinity = metaData.range(47,40);
+			peToUse = (affinity != 0) ? (ap_uint<16>)(affinity % PE_PER_HANDLER) : nextPe;
+
 			ap_uint<32> currentCode = metaData.range(15,0);
 
 			ap_uint<512> sendData = currentCode;
 			sendData.range(63,32) = batchCount;
 			sendData.range(95,64) = totalIterations;
 			sendData.range(223,96) = elements;
+			//THE HOST'S ARGUMENT FOR THE PE
+			sendData.range(255,224) = metaData.range(255,224);
+			sendData.range(319,256) = metaData.range(319,256);
 			rerouteToUser[peToUse].write(sendData);
 				
 			iterationsCounter = 0;
@@ -341,10 +768,20 @@ void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 		}else if(fsm == 2){
 			if(iterationsCounter >= totalIterations){
 				fsm = 0;
-				peToUse++;
+				if(metaData.range(47,40) == 0){
+					nextPe++;
 
-				if(peToUse == PE_PER_HANDLER){
-					peToUse = 0;
+					if(nextPe == PE_PER_HANDLER){
+						nextPe = 0;
+					}
+				}
+
+				//EVERY PE NEEDS ITS OWN EXIT CODE, THE HOST SENDS PE_PER_HANDLER OF THEM
+				if(metaData.range(15,0) == 1){
+					exitCount++;
+					if(exitCount == PE_PER_HANDLER){
+						break;
+					}
 				}
 			}else{
 				ap_uint<512> sendData;
@@ -353,102 +790,130 @@ void sendDataUser(hls::stream<ap_uint<512>>& valueData,
 					iterationsCounter++;
 				}
 			}	
-			if(metaData.range(15,0) == 1){
-				break;
-			}
 		}
 	}	
 }
 
+template<typename GEOMETRY>
 void receiveDataUser(hls::stream<struct writeOutPkt>& outPktData,
 	hls::stream<ap_uint<512>>& fromWaitTask,
 	hls::stream<ap_uint<513>> rerouteFromUser[PE_PER_HANDLER],
 	hls::stream<bool> stopSignalReroute[PE_PER_HANDLER],
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE, const ap_uint<32> DATA_OUT_SECTION_SIZE){
+	const GEOMETRY geometry){
 	#pragma HLS inline off
+	const ap_uint<32> BUFFER_SECTIONS = geometry.sections();
+	const ap_uint<32> DATA_IN_SECTION_SIZE = geometry.inLines();
+	const ap_uint<32> DATA_OUT_SECTION_SIZE = geometry.outLines();
+
+	//ONE RETIRE CONTEXT PER PE: 0 WAITING FOR A REQUEST, 1 WAITING FOR THE ACK, 2 COPYING OUTPUT LINES AND SIZES
+	ap_uint<512> metaData[PE_PER_HANDLER];
+	ap_uint<2> fsm[PE_PER_HANDLER];
+	ap_uint<32> memIndexOut[PE_PER_HANDLER];
+	ap_uint<4> count[PE_PER_HANDLER];
+	#pragma HLS array_partition variable=metaData dim=0 complete
+	#pragma HLS array_partition variable=fsm dim=0 complete
+	#pragma HLS array_partition variable=memIndexOut dim=0 complete
+	#pragma HLS array_partition variable=count dim=0 complete
 
-	ap_uint<32> memIndexOut = 0;
-	ap_uint<512> metaData = 0;
-	ap_uint<4> fsm = 0;
+	for(ap_uint<32> i = 0; i < PE_PER_HANDLER; i++){
+		fsm[i] = 0;
+	}
 
 	ap_uint<32> peToUse = 0;
-	ap_uint<32> bufferSectionCounter = 0;
-	ap_uint<32> batchCount = 0;
-
-	ap_uint<4> count = 0;
+	ap_uint<32> nextPe = 0;
+	ap_uint<32> exitCount = 0;
+	bool holding = false;
 
 	ap_uint<513> dataFromUser;
 	ap_uint<512> fromSendProc;
 
+	//META LINES WAITING FOR THEIR RESULT, ONE QUEUE PER PE IN THE ORDER sendDataUser DISPATCHED THEM
+	const unsigned int PENDING_META_PRAGMA = GEOMETRY::PENDING_META;
+	hls::stream<ap_uint<512> > pendingMeta[PE_PER_HANDLER];
+	#pragma HLS stream variable=pendingMeta depth=PENDING_META_PRAGMA
+
 	RECEIVE_HASHES: while(true){
 		#pragma HLS loop_tripcount max=10 min=10
 		#pragma HLS pipeline
-		if(fsm == 0){
-			if(fromWaitTask.read_nb(fromSendProc)){
-				metaData = fromSendProc;
-				batchCount = metaData.range(47,32);
-
-				count = 0;
-				memIndexOut = 0;
-				fsm = 1;
+		//THE META LINE IS HELD UNTIL THE QUEUE OF ITS PE HAS ROOM, THE PE COMES FROM ITS AFFINITY LIKE IN sendDataUser
+		if(!holding && fromWaitTask.read_nb(fromSendProc)){
+			holding = true;
+		}
+		if(holding){
+			ap_uint<8> affinity = fromSendProc.range(47,40);
+			ap_uint<32> peToFill = (affinity != 0) ? (ap_uint<32>)(affinity % PE_PER_HANDLER) : nextPe;
+			if(!pendingMeta[peToFill].full()){
+				pendingMeta[peToFill].write(fromSendProc);
+				holding = false;
+				if(affinity == 0){
+					nextPe++;
+					if(nextPe == PE_PER_HANDLER){
+						nextPe = 0;
+					}
+				}
 			}
-		}else if(fsm == 1){	
-			if(rerouteFromUser[peToUse].read_nb(dataFromUser)){
-				metaData.range(31,16) = dataFromUser.range(15,0);	
-				fsm = 2;
+		}
+
+		//STAY ON ONE PE WHILE IT HAS LINES WAITING SO ITS WRITES STAY IN BURSTS, MOVE ON AS SOON AS IT RUNS DRY.
+		//A LONG REQUEST ON ONE PE THEN NO LONGER HOLDS BACK THE META LINES OF SHORT ONES ON THE OTHERS
+		bool moveOn = true;
+		if(fsm[peToUse] == 0){
+			if(!pendingMeta[peToUse].empty()){
+				metaData[peToUse] = pendingMeta[peToUse].read();
+				count[peToUse] = 0;
+				memIndexOut[peToUse] = 0;
+				fsm[peToUse] = 1;
+				moveOn = false;
 			}
-		}else if(fsm == 2){
-			if(rerouteFromUser[peToUse].read_nb(dataFromUser)){
+		}else if(rerouteFromUser[peToUse].read_nb(dataFromUser)){
+			moveOn = false;
+			if(fsm[peToUse] == 1){
+				metaData[peToUse].range(31,16) = dataFromUser.range(15,0);
+				fsm[peToUse] = 2;
+			}else if(dataFromUser.range(512,512) == 0){
 				struct writeOutPkt pkt;
-				pkt.addr = BUFFER_SECTIONS+BUFFER_SECTIONS*DATA_IN_SECTION_SIZE+bufferSectionCounter*DATA_OUT_SECTION_SIZE+memIndexOut;
+				pkt.addr = BUFFER_SECTIONS+SLOT_OFFSET_LINES+BUFFER_SECTIONS*DATA_IN_SECTION_SIZE+metaData[peToUse].range(351,320)*DATA_OUT_SECTION_SIZE+memIndexOut[peToUse];
 				pkt.stop = 0;
-
-				if(dataFromUser.range(512,512) == 1){
-					metaData.range(255+count*32,224+count*32) = dataFromUser.range(31,0);
-
-					fsm = 3;
-				}else{
-					pkt.value = dataFromUser.range(511,0);
-					memIndexOut++;
-					outPktData.write(pkt);
-				}
-			}
-			
-		}else if(fsm == 3){
-			count++;
-			if(count < batchCount){
-				fsm = 2;
+				pkt.value = dataFromUser.range(511,0);
+				memIndexOut[peToUse]++;
+				outPktData.write(pkt);
 			}else{
-				struct writeOutPkt pkt;				
+				//THE FIRST DATA SLOT IN BITS 320-351 IS ONLY OVERWRITTEN BY THE LAST OF FOUR OUTPUT SIZES
+				metaData[peToUse].range(255+count[peToUse]*32,224+count[peToUse]*32) = dataFromUser.range(31,0);
+				count[peToUse]++;
 
-				pkt.addr = bufferSectionCounter;
-				pkt.stop = 0;
+				if(count[peToUse] >= metaData[peToUse].range(39,32)){
+					struct writeOutPkt pkt;
 
-				metaData.range(447,416) = 2;
-					
-				if(metaData.range(15,0) == 1){
-					pkt.stop = 1;
-				}else{
-					pkt.stop = 2;
-				}
-				pkt.value = metaData;
-				outPktData.write(pkt);
+					//pollMeta PASSED THE META SECTION IN THE STATUS WORD. THE HOST SCANS EVERY SECTION IN FLIGHT FOR STATUS 2
+					pkt.addr = metaData[peToUse].range(447,416);
+					metaData[peToUse].range(447,416) = 2;
 
-				fsm = 0;
+					if(metaData[peToUse].range(15,0) == 1){
+						pkt.stop = 1;
+					}else{
+						pkt.stop = 2;
+					}
+					pkt.value = metaData[peToUse];
+					outPktData.write(pkt);
 
-				bufferSectionCounter++;
-				peToUse++;
+					fsm[peToUse] = 0;
+					moveOn = true;
 
-				if(bufferSectionCounter == BUFFER_SECTIONS){
-					bufferSectionCounter = 0;
-				}
-				if(peToUse == PE_PER_HANDLER){
-					peToUse = 0;
+					if(metaData[peToUse].range(15,0) == 1){
+						exitCount++;
+						if(exitCount == PE_PER_HANDLER){
+							break;
+						}
+					}
 				}
+			}
+		}
 
-				if(metaData.range(15,0) == 1){
-					break;
-				}
+		if(moveOn){
+			peToUse++;
+			if(peToUse == PE_PER_HANDLER){
+				peToUse = 0;
 			}
 		}
 	}
@@ -457,17 +922,19 @@ void receiveDataUser(hls::stream<struct writeOutPkt>& outPktData,
 	}
 }
 
-void wrapperUserHostMemPE(ap_uint<512>* hostMemorySection,
+template<typename GEOMETRY>
+void wrapperUserHostMemPE(hls::burst_maxi<ap_uint<512> > hostMemorySection,
+	hls::burst_maxi<ap_uint<512> > hostMemoryMeta,
 	hls::stream<ap_uint<512> > rerouteToUser[PE_PER_HANDLER],
 	hls::stream<ap_uint<513> > rerouteFromUser[PE_PER_HANDLER],
 	hls::stream<bool> stopSignal[PE_PER_HANDLER],
-	const ap_uint<32> BUFFER_SECTIONS, const ap_uint<32> DATA_IN_SECTION_SIZE, const ap_uint<32> DATA_OUT_SECTION_SIZE){
+	const GEOMETRY geometry){
 
 	#pragma HLS inline off
 
 	#pragma HLS dataflow
 
-	hls::stream<ap_uint<512>> waitToProcs[2];
+	hls::stream<ap_uint<512>> waitToProcs[META_CONSUMERS];
 	#pragma HLS stream variable=waitToProcs depth=4
 	hls::stream<struct writeOutPkt> outPktDataPipe;
 	#pragma HLS stream variable=outPktDataPipe depth=4
@@ -480,44 +947,58 @@ void wrapperUserHostMemPE(ap_uint<512>* hostMemorySection,
 	hls::stream<ap_uint<512>> valueResponseMeta;
 	#pragma HLS stream variable=valueResponseMeta depth=16
 	#pragma HLS bind_storage variable=valueResponseMeta type=FIFO impl=bram
+	//ROOM FOR A WHOLE READ BURST SO THE READ ENGINE NEVER STALLS HALF WAY THROUGH ONE
+	const unsigned int DATA_BURST_PRAGMA = DATA_BURST_LENGTH;
 	hls::stream<ap_uint<512>> valueResponseData;
-	#pragma HLS stream variable=valueResponseData depth=8
+	#pragma HLS stream variable=valueResponseData depth=DATA_BURST_PRAGMA
+	#pragma HLS bind_storage variable=valueResponseData type=FIFO impl=bram
 
 	hls::stream<ap_uint<1>> command;
 	hls::stream<ap_uint<64>> outputCycle;
 	hls::stream<ap_uint<32>> testStream;
 
-	hls::stream<ap_uint<64>> time;
-	hls::stream<bool> alarm;
-
 	cycleCounter(command, outputCycle);
-	sleepTimer(time, alarm);
 
-	memoryHandleReadRequests(hostMemorySection, 
+	memoryHandleMetaReads(hostMemoryMeta, 
 		readRequestMeta, 
+		valueResponseMeta);
+
+	memoryHandleDataReads(hostMemorySection, 
 		readRequestData, 
-		valueResponseMeta,
 		valueResponseData);
 
 	pollMeta(readRequestMeta, 
 		readRequestData,
 		valueResponseMeta, 
 		waitToProcs, 
-		BUFFER_SECTIONS, DATA_IN_SECTION_SIZE,
+		geometry,
 		command, outputCycle, testStream);
 	
+#if HM_COMPRESS
+	hls::stream<ap_uint<512>> unpackedData;
+	#pragma HLS stream variable=unpackedData depth=16
+
+	unpackDataUser(valueResponseData,
+		waitToProcs[2],
+		unpackedData);
+
+	sendDataUser(unpackedData,
+		waitToProcs[0],
+		rerouteToUser);
+#else
 	sendDataUser(valueResponseData,
 		waitToProcs[0],
 		rerouteToUser);
+#endif
  
 	receiveDataUser(outPktDataPipe,
 		waitToProcs[1],
 		rerouteFromUser,
 		stopSignal,
-		BUFFER_SECTIONS, DATA_IN_SECTION_SIZE, DATA_OUT_SECTION_SIZE);
+		geometry);
 
 	memoryHandlerWrite(outPktDataPipe, hostMemorySection, 
-		time, alarm, testStream);	
+		testStream);	
 }	
 
 void wrapperHostMemStrmToUser(hls::stream<ap_uint<512> >& rerouteToUser, hls::stream<ap_axiu<512,0,0,0> >& hostMemStrmToUser, hls::stream<bool>& stopSignal){
@@ -556,4 +1037,21 @@ void wrapperHostMemStrmFromUser(hls::stream<ap_uint<513> >& rerouteFromUser, hls
 	}
 }
 
-
+//ONLY THE GEOMETRY memAccelerate IS BUILT WITH IS INSTANTIATED
+template void pollMeta<HMGeometry>(hls::stream<struct readPktReq>& readRequestMeta, 
+	hls::stream<struct readPktReq>& readRequestData,
+	hls::stream<ap_uint<512>>& valueMeta, 
+	hls::stream<ap_uint<512>> toProcTask[META_CONSUMERS], 
+	const HMGeometry geometry,
+	hls::stream<ap_uint<1>>& command, hls::stream<ap_uint<64>>& outputCycle, hls::stream<ap_uint<32>>& testStream);
+template void receiveDataUser<HMGeometry>(hls::stream<struct writeOutPkt>& outPktData,
+	hls::stream<ap_uint<512>>& fromWaitTask,
+	hls::stream<ap_uint<513>> rerouteFromUser[PE_PER_HANDLER],
+	hls::stream<bool> stopSignalReroute[PE_PER_HANDLER],
+	const HMGeometry geometry);
+template void wrapperUserHostMemPE<HMGeometry>(hls::burst_maxi<ap_uint<512> > hostMemorySection,
+	hls::burst_maxi<ap_uint<512> > hostMemoryMeta,
+	hls::stream<ap_uint<512> > rerouteToUser[PE_PER_HANDLER],
+	hls::stream<ap_uint<513> > rerouteFromUser[PE_PER_HANDLER],
+	hls::stream<bool> stopSignal[PE_PER_HANDLER],
+	const HMGeometry geometry);